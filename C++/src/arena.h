@@ -0,0 +1,145 @@
+#pragma once
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <sys/mman.h>
+#include <vector>
+
+using namespace std;
+
+// Bump allocator for the scratch buffers of a proving or verifying session.
+// Memory comes in 64-byte aligned blocks backed by transparent huge pages
+// where the kernel allows, so large round buffers cost a handful of page
+// faults instead of one per 4 KB. alloc() only moves a pointer; rewind()
+// releases everything allocated after a mark and reset() everything, keeping
+// the blocks for the next proof. Once a session has proven a batch of some
+// size, proving another one of at most that size allocates nothing. Not
+// thread safe: buffers for parallel work are allocated by the calling thread
+// before the work is started.
+class Arena {
+public:
+    struct Mark {
+        uint64_t block;
+        uint64_t used;
+    };
+
+    explicit Arena(uint64_t min_block_bytes = 1 << 21) : min_block_bytes(min_block_bytes) {}
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena() {
+        for(int i = 0; i < blocks.size(); i++) {
+            free(blocks[i].data);
+        }
+    }
+
+    // count uninitialized objects of a trivially constructible type T
+    template<class T>
+    T* alloc(uint64_t count) {
+        uint64_t bytes = (count * sizeof(T) + 63) / 64 * 64;
+        while(current < blocks.size() && blocks[current].used + bytes > blocks[current].size) {
+            current++;
+            if (current < blocks.size()) {
+                blocks[current].used = 0;
+            }
+        }
+        if (current == blocks.size()) {
+            add_block(bytes);
+        }
+        Block& block = blocks[current];
+        T* result = (T*)(block.data + block.used);
+        block.used += bytes;
+        return result;
+    }
+
+    template<class T>
+    T* alloc_zero(uint64_t count) {
+        T* result = alloc<T>(count);
+        memset((void*)result, 0, count * sizeof(T));
+        return result;
+    }
+
+    Mark mark() const {
+        return {current, current < blocks.size() ? blocks[current].used : 0};
+    }
+
+    void rewind(const Mark& mark) {
+        current = mark.block;
+        if (current < blocks.size()) {
+            blocks[current].used = mark.used;
+        }
+    }
+
+    // Releases every buffer. If the last proof needed more than one block,
+    // they are merged into one so the next proof fits without new blocks.
+    void reset() {
+        if (blocks.size() > 1) {
+            uint64_t total = 0;
+            for(int i = 0; i < blocks.size(); i++) {
+                total += blocks[i].size;
+                free(blocks[i].data);
+            }
+            blocks.clear();
+            add_block(total);
+        }
+        current = 0;
+        if (!blocks.empty()) {
+            blocks[0].used = 0;
+        }
+    }
+
+    // Bytes held by the arena, used or not
+    uint64_t capacity() const {
+        uint64_t total = 0;
+        for(int i = 0; i < blocks.size(); i++) {
+            total += blocks[i].size;
+        }
+        return total;
+    }
+
+    uint64_t num_blocks() const {
+        return blocks.size();
+    }
+
+private:
+    struct Block {
+        char* data;
+        uint64_t size;
+        uint64_t used;
+    };
+
+    void add_block(uint64_t bytes) {
+        const uint64_t huge_page = 1 << 21;
+        uint64_t size = bytes > min_block_bytes ? bytes : min_block_bytes;
+        size = (size + huge_page - 1) / huge_page * huge_page;
+        char* data = (char*)aligned_alloc(huge_page, size);
+        if (data == nullptr) {
+            throw bad_alloc();
+        }
+        madvise(data, size, MADV_HUGEPAGE);
+        blocks.push_back({data, size, 0});
+        current = blocks.size() - 1;
+    }
+
+    uint64_t min_block_bytes;
+    vector<Block> blocks;
+    uint64_t current = 0;
+};
+
+// Rewinds the arena to where it was on construction, so the buffers a scope
+// allocates are released when it exits
+class ArenaScope {
+public:
+    explicit ArenaScope(Arena& arena) : arena(arena), start(arena.mark()) {}
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+
+    ~ArenaScope() {
+        arena.rewind(start);
+    }
+
+private:
+    Arena& arena;
+    Arena::Mark start;
+};
@@ -1,3 +1,4 @@
+#pragma once
 #include<cstdio>
 #include<cmath>
 #include<iostream>
@@ -52,6 +53,18 @@ uint64_t mul_modp(uint64_t a, uint64_t b) {
     return add_modp(higher, lower);
 }
 
+uint64_t pow_modp(uint64_t a, uint64_t e) {
+    uint64_t res = 1;
+    while(e > 0) {
+        if (e & 1) {
+            res = mul_modp(res, a);
+        }
+        a = mul_modp(a, a);
+        e >>= 1;
+    }
+    return res;
+}
+
 uint64_t inverse(uint64_t a) {
     uint64_t left = a;
     uint64_t right = PR;
@@ -78,7 +91,28 @@ uint64_t inverse(uint64_t a) {
     return u;
 }
 
-uint64_t inner_productp(uint64_t* a, uint64_t* b, uint64_t size) {
+// out[i] = a[i]^-1 for nonzero a[i], with a single inverse() (Montgomery's trick).
+// out may alias a.
+void batch_inverse(const uint64_t* a, uint64_t size, uint64_t* out) {
+    if (size == 0) {
+        return;
+    }
+    uint64_t* prefix = new uint64_t[size];
+    prefix[0] = a[0];
+    for(int i = 1; i < size; i++) {
+        prefix[i] = mul_modp(prefix[i - 1], a[i]);
+    }
+    uint64_t inv = inverse(prefix[size - 1]);
+    for(int i = size - 1; i > 0; i--) {
+        uint64_t a_i = a[i];
+        out[i] = mul_modp(inv, prefix[i - 1]);
+        inv = mul_modp(inv, a_i);
+    }
+    out[0] = inv;
+    delete[] prefix;
+}
+
+uint64_t inner_productp_scalar(const uint64_t* a, const uint64_t* b, uint64_t size) {
     uint128_t result = 0;
     uint64_t bound = 63;
     uint64_t start, end;
@@ -100,7 +134,7 @@ uint64_t inner_productp(uint64_t* a, uint64_t* b, uint64_t size) {
     return result;
 }
 
-uint64_t batch_add_modp(uint64_t* a, uint64_t* b, uint64_t size) {
+uint64_t batch_add_modp_scalar(uint64_t* a, uint64_t* b, uint64_t size) {
     uint128_t result = 0;
     uint64_t bound = 63;
     uint64_t start, end;
@@ -122,7 +156,7 @@ uint64_t batch_add_modp(uint64_t* a, uint64_t* b, uint64_t size) {
     return result;
 }
 
-uint64_t batch_sum_modp(uint64_t* a, uint64_t size) {
+uint64_t batch_sum_modp_scalar(uint64_t* a, uint64_t size) {
     uint128_t result = 0;
     uint64_t bound = 63;
     uint64_t start, end;
@@ -142,4 +176,276 @@ uint64_t batch_sum_modp(uint64_t* a, uint64_t size) {
         if (start == size) break;
     }
     return result;
-}
\ No newline at end of file
+}
+
+void batch_mul_modp_scalar(uint64_t* a, uint64_t* b, uint64_t* out, uint64_t size) {
+    for(int i = 0; i < size; i++) {
+        out[i] = mul_modp(a[i], b[i]);
+    }
+}
+
+// out[j] = sum of coeffs[l] * rows[l][offset + j] over l < k, for j < size.
+// out may alias rows[l] + offset: each output is written after its inputs are read.
+void fold_modp_scalar(uint64_t** rows, uint64_t* coeffs, uint64_t k, uint64_t offset, uint64_t size, uint64_t* out) {
+    uint128_t temp_result;
+    for(int j = 0; j < size; j++) {
+        temp_result = 0;
+        for(int l = 0; l < k; l++) {
+            temp_result += ((uint128_t) coeffs[l]) * ((uint128_t) rows[l][offset + j]);
+            if (l % 63 == 62) {
+                temp_result = modp_128(temp_result);
+            }
+        }
+        out[j] = modp_128(temp_result);
+    }
+}
+
+// fold_modp_scalar() for k = K known at compile time: the loop over the rows
+// is unrolled and the coefficients and row pointers stay in registers. Up to
+// 63 products fit in 128 bits, so nothing is reduced before the end.
+template<int K>
+void fold_modp_fixed_scalar(uint64_t** rows, const uint64_t* coeffs, uint64_t offset, uint64_t size, uint64_t* out) {
+    const uint64_t* r[K];
+    uint64_t c[K];
+    for(int l = 0; l < K; l++) {
+        r[l] = rows[l] + offset;
+        c[l] = coeffs[l];
+    }
+    for(uint64_t j = 0; j < size; j++) {
+        uint128_t acc = 0;
+        for(int l = 0; l < K; l++) {
+            acc += (uint128_t)c[l] * r[l][j];
+        }
+        out[j] = modp_128(acc);
+    }
+}
+
+// out[j] = first * step^j for j < size. Eight chains run side by side, each
+// stepping by step^8, so no multiplication waits on the one before it.
+void powers_modp_scalar(uint64_t first, uint64_t step, uint64_t size, uint64_t* out) {
+    uint64_t x = first;
+    for(int j = 0; j < size && j < 8; j++) {
+        out[j] = x;
+        x = mul_modp(x, step);
+    }
+    uint64_t step8 = pow_modp(step, 8);
+    for(uint64_t j = 8; j < size; j++) {
+        out[j] = mul_modp(out[j - 8], step8);
+    }
+}
+
+// Sum of a[j] * first * step^j over j < size without storing the powers:
+// eight chains as in powers_modp_scalar(), products summed in 128 bits and
+// reduced every 56 of them
+uint64_t powers_inner_productp_scalar(const uint64_t* a, uint64_t first, uint64_t step, uint64_t size) {
+    uint64_t powers[8];
+    powers_modp_scalar(first, step, 8, powers);
+    if (size < 8) {
+        return inner_productp_scalar(a, powers, size);
+    }
+    uint64_t step8 = pow_modp(step, 8);
+    uint128_t result = 0;
+    uint64_t j = 0;
+    for(uint64_t group = 1; j + 8 <= size; j += 8, group++) {
+        for(int l = 0; l < 8; l++) {
+            result += (uint128_t)a[j + l] * powers[l];
+            powers[l] = mul_modp(powers[l], step8);
+        }
+        if (group % 7 == 0) {
+            result = modp_128(result);
+        }
+    }
+    result = modp_128(result);
+    return add_modp(result, inner_productp_scalar(a + j, powers, size - j));
+}
+
+// Vector kernels reuse the scalar versions above for their tails
+#include "arithmetic_simd.h"
+
+enum SimdLevel {
+    SIMD_SCALAR = 0,
+    SIMD_AVX2 = 1,
+    SIMD_AVX512_IFMA = 2
+};
+
+SimdLevel detect_simd_level() {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512ifma")) {
+        return SIMD_AVX512_IFMA;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return SIMD_AVX2;
+    }
+#endif
+    return SIMD_SCALAR;
+}
+
+// Kernel set used by the dispatchers below. May be lowered (never raised
+// above detect_simd_level()) to compare against the scalar code.
+SimdLevel simd_level = detect_simd_level();
+
+const char* simd_level_name(SimdLevel level) {
+    switch(level) {
+        case SIMD_AVX512_IFMA: return "AVX-512 IFMA";
+        case SIMD_AVX2: return "AVX2";
+        default: return "scalar";
+    }
+}
+
+uint64_t inner_productp(const uint64_t* a, const uint64_t* b, uint64_t size) {
+#if defined(__x86_64__)
+    if (simd_level == SIMD_AVX512_IFMA) return inner_productp_ifma(a, b, size);
+    if (simd_level == SIMD_AVX2) return inner_productp_avx2(a, b, size);
+#endif
+    return inner_productp_scalar(a, b, size);
+}
+
+uint64_t batch_add_modp(uint64_t* a, uint64_t* b, uint64_t size) {
+#if defined(__x86_64__)
+    if (simd_level != SIMD_SCALAR) return batch_add_modp_avx2(a, b, size);
+#endif
+    return batch_add_modp_scalar(a, b, size);
+}
+
+uint64_t batch_sum_modp(uint64_t* a, uint64_t size) {
+#if defined(__x86_64__)
+    if (simd_level != SIMD_SCALAR) return batch_sum_modp_avx2(a, size);
+#endif
+    return batch_sum_modp_scalar(a, size);
+}
+
+void batch_mul_modp(uint64_t* a, uint64_t* b, uint64_t* out, uint64_t size) {
+#if defined(__x86_64__)
+    if (simd_level == SIMD_AVX512_IFMA) return batch_mul_modp_ifma(a, b, out, size);
+    if (simd_level == SIMD_AVX2) return batch_mul_modp_avx2(a, b, out, size);
+#endif
+    batch_mul_modp_scalar(a, b, out, size);
+}
+
+template<int K>
+void fold_modp_fixed(uint64_t** rows, const uint64_t* coeffs, uint64_t offset, uint64_t size, uint64_t* out) {
+#if defined(__x86_64__)
+    if (simd_level == SIMD_AVX512_IFMA) return fold_modp_fixed_ifma<K>(rows, coeffs, offset, size, out);
+    if (simd_level == SIMD_AVX2) return fold_modp_fixed_avx2<K>(rows, coeffs, offset, size, out);
+#endif
+    fold_modp_fixed_scalar<K>(rows, coeffs, offset, size, out);
+}
+
+void fold_modp_generic(uint64_t** rows, uint64_t* coeffs, uint64_t k, uint64_t offset, uint64_t size, uint64_t* out) {
+#if defined(__x86_64__)
+    if (simd_level == SIMD_AVX512_IFMA) return fold_modp_ifma(rows, coeffs, k, offset, size, out);
+    if (simd_level == SIMD_AVX2) return fold_modp_avx2(rows, coeffs, k, offset, size, out);
+#endif
+    fold_modp_scalar(rows, coeffs, k, offset, size, out);
+}
+
+// out[j] = sum of coeffs[l] * rows[l][offset + j] over l < k. The common
+// compression factors 2, 4, 8 and 16 have kernels specialized on k.
+void fold_modp(uint64_t** rows, uint64_t* coeffs, uint64_t k, uint64_t offset, uint64_t size, uint64_t* out) {
+    switch(k) {
+        case 2: return fold_modp_fixed<2>(rows, coeffs, offset, size, out);
+        case 4: return fold_modp_fixed<4>(rows, coeffs, offset, size, out);
+        case 8: return fold_modp_fixed<8>(rows, coeffs, offset, size, out);
+        case 16: return fold_modp_fixed<16>(rows, coeffs, offset, size, out);
+    }
+    fold_modp_generic(rows, coeffs, k, offset, size, out);
+}
+
+// out[j] = first * step^j for j < size; used for the eta weights
+void powers_modp(uint64_t first, uint64_t step, uint64_t size, uint64_t* out) {
+#if defined(__x86_64__)
+    if (simd_level == SIMD_AVX512_IFMA) return powers_modp_ifma(first, step, size, out);
+    if (simd_level == SIMD_AVX2) return powers_modp_avx2(first, step, size, out);
+#endif
+    powers_modp_scalar(first, step, size, out);
+}
+
+// Sum of a[j] * first * step^j over j < size, the powers made on the fly
+uint64_t powers_inner_productp(const uint64_t* a, uint64_t first, uint64_t step, uint64_t size) {
+#if defined(__x86_64__)
+    if (simd_level == SIMD_AVX512_IFMA) return powers_inner_productp_ifma(a, first, step, size);
+    if (simd_level == SIMD_AVX2) return powers_inner_productp_avx2(a, first, step, size);
+#endif
+    return powers_inner_productp_scalar(a, first, step, size);
+}
+
+// out[i * k + j] = <a[i] + offset, b[j] + offset> over size entries, for all
+// i, j < k, in one pass over the rows. The scalar version walks the rows in
+// blocks of 63 entries and forms the k^2 products 2x2 at a time in 128-bit
+// register accumulators, reducing once per block; with vector kernels the
+// rows are walked in tiles small enough to stay in L1 while all k^2 products
+// of a tile are formed. Either way each row is read from memory once instead
+// of k times.
+void inner_product_matrixp_scalar(uint64_t** a, uint64_t** b, uint64_t k, uint64_t offset, uint64_t size, uint64_t* out) {
+    for(int i = 0; i < k * k; i++) {
+        out[i] = 0;
+    }
+    uint64_t bound = 63;
+    uint64_t start = offset, end;
+    while(start < offset + size) {
+        end = start + bound < offset + size ? start + bound : offset + size;
+        for(int i = 0; i < k; i += 2) {
+            uint64_t* a0 = a[i];
+            uint64_t* a1 = a[i + 1 < k ? i + 1 : i];
+            for(int j = 0; j < k; j += 2) {
+                uint64_t* b0 = b[j];
+                uint64_t* b1 = b[j + 1 < k ? j + 1 : j];
+                uint128_t acc00 = 0, acc01 = 0, acc10 = 0, acc11 = 0;
+                for(uint64_t t = start; t < end; t++) {
+                    acc00 += ((uint128_t)a0[t]) * b0[t];
+                    acc01 += ((uint128_t)a0[t]) * b1[t];
+                    acc10 += ((uint128_t)a1[t]) * b0[t];
+                    acc11 += ((uint128_t)a1[t]) * b1[t];
+                }
+                out[i * k + j] = modp_128(acc00 + out[i * k + j]);
+                if (j + 1 < k) {
+                    out[i * k + j + 1] = modp_128(acc01 + out[i * k + j + 1]);
+                }
+                if (i + 1 < k) {
+                    out[(i + 1) * k + j] = modp_128(acc10 + out[(i + 1) * k + j]);
+                    if (j + 1 < k) {
+                        out[(i + 1) * k + j + 1] = modp_128(acc11 + out[(i + 1) * k + j + 1]);
+                    }
+                }
+            }
+        }
+        start = end;
+    }
+}
+
+template<int K>
+void inner_product_matrixp_fixed(uint64_t** a, uint64_t** b, uint64_t offset, uint64_t size, uint64_t* out) {
+#if defined(__x86_64__)
+    if (simd_level == SIMD_AVX512_IFMA) return inner_product_matrixp_fixed_ifma<K>(a, b, offset, size, out);
+    if (simd_level == SIMD_AVX2) return inner_product_matrixp_fixed_avx2<K>(a, b, offset, size, out);
+#endif
+    inner_product_matrixp_scalar(a, b, K, offset, size, out);
+}
+
+void inner_product_matrixp(uint64_t** a, uint64_t** b, uint64_t k, uint64_t offset, uint64_t size, uint64_t* out) {
+    if (simd_level == SIMD_SCALAR) {
+        inner_product_matrixp_scalar(a, b, k, offset, size, out);
+        return;
+    }
+    // The vector kernels have versions specialized on the common k
+    switch(k) {
+        case 2: return inner_product_matrixp_fixed<2>(a, b, offset, size, out);
+        case 4: return inner_product_matrixp_fixed<4>(a, b, offset, size, out);
+        case 8: return inner_product_matrixp_fixed<8>(a, b, offset, size, out);
+        case 16: return inner_product_matrixp_fixed<16>(a, b, offset, size, out);
+    }
+    // 2k rows of one tile take about 32KB
+    uint64_t tile = 2048 / k < 64 ? 64 : 2048 / k / 8 * 8;
+    for(int i = 0; i < k * k; i++) {
+        out[i] = 0;
+    }
+    for(uint64_t start = 0; start < size; start += tile) {
+        uint64_t len = start + tile < size ? tile : size - start;
+        for(int i = 0; i < k; i++) {
+            for(int j = 0; j < k; j++) {
+                out[i * k + j] = add_modp(out[i * k + j], inner_productp(a[i] + offset + start, b[j] + offset + start, len));
+            }
+        }
+    }
+}
@@ -0,0 +1,523 @@
+#pragma once
+// Vectorized kernels for arithmetic modulo PR = 2^61 - 1. They are compiled
+// for their target through function attributes and are only called after
+// arithmetic.h has checked CPUID, so the rest of the file needs no -m flags.
+//
+// Products of 61-bit values are split into partial products whose sums are
+// kept in three 64-bit accumulators (acc0, acc1, acc2) weighted by 2^0, 2^w
+// and 2^2w, where w = 32 for AVX2 (vpmuludq) and w = 52 for AVX-512 IFMA
+// (vpmadd52luq/vpmadd52huq). Reduction modulo PR is deferred until the
+// accumulators are about to overflow.
+
+#if defined(__x86_64__)
+#include<immintrin.h>
+
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#define SIMD_TARGET_IFMA __attribute__((target("avx512f,avx512ifma")))
+
+// Any 64-bit lane to [0, PR)
+SIMD_TARGET_AVX2 static inline __m256i reduce_avx2(__m256i x) {
+    const __m256i pr = _mm256_set1_epi64x(PR);
+    x = _mm256_add_epi64(_mm256_srli_epi64(x, PRIME_EXP), _mm256_and_si256(x, pr));
+    // x < 2^62, so a signed comparison is enough
+    __m256i ge = _mm256_cmpgt_epi64(x, _mm256_set1_epi64x(PR - 1));
+    return _mm256_sub_epi64(x, _mm256_and_si256(ge, pr));
+}
+
+// acc0 + acc1 * 2^32 + acc2 * 2^64 to [0, PR), with 2^64 = 2^3 and 2^61 = 1
+SIMD_TARGET_AVX2 static inline __m256i reduce_partials_avx2(__m256i acc0, __m256i acc1, __m256i acc2) {
+    const __m256i pr = _mm256_set1_epi64x(PR);
+    __m256i low29 = _mm256_set1_epi64x((1ULL << 29) - 1);
+    __m256i low58 = _mm256_set1_epi64x((1ULL << 58) - 1);
+    __m256i x = _mm256_add_epi64(_mm256_srli_epi64(acc0, PRIME_EXP), _mm256_and_si256(acc0, pr));
+    x = _mm256_add_epi64(x, _mm256_srli_epi64(acc1, 29));
+    x = _mm256_add_epi64(x, _mm256_slli_epi64(_mm256_and_si256(acc1, low29), 32));
+    x = _mm256_add_epi64(x, _mm256_srli_epi64(acc2, 58));
+    x = _mm256_add_epi64(x, _mm256_slli_epi64(_mm256_and_si256(acc2, low58), 3));
+    return reduce_avx2(x);
+}
+
+// Adds the 32x32 partial products of x * y into the three accumulators, with
+// xh = x >> 32 given. Each call adds less than 2^34 to acc0, acc1 and less
+// than 2^59 to acc2.
+SIMD_TARGET_AVX2 static inline void mul_acc_split_avx2(__m256i x, __m256i xh, __m256i y, __m256i &acc0, __m256i &acc1, __m256i &acc2) {
+    const __m256i low32 = _mm256_set1_epi64x(0xffffffffULL);
+    __m256i yh = _mm256_srli_epi64(y, 32);
+    __m256i ll = _mm256_mul_epu32(x, y);
+    __m256i lh = _mm256_mul_epu32(x, yh);
+    __m256i hl = _mm256_mul_epu32(xh, y);
+    __m256i hh = _mm256_mul_epu32(xh, yh);
+    acc0 = _mm256_add_epi64(acc0, _mm256_and_si256(ll, low32));
+    acc1 = _mm256_add_epi64(acc1, _mm256_srli_epi64(ll, 32));
+    acc1 = _mm256_add_epi64(acc1, _mm256_and_si256(lh, low32));
+    acc1 = _mm256_add_epi64(acc1, _mm256_and_si256(hl, low32));
+    acc2 = _mm256_add_epi64(acc2, _mm256_srli_epi64(lh, 32));
+    acc2 = _mm256_add_epi64(acc2, _mm256_srli_epi64(hl, 32));
+    acc2 = _mm256_add_epi64(acc2, hh);
+}
+
+SIMD_TARGET_AVX2 static inline void mul_acc_avx2(__m256i x, __m256i y, __m256i &acc0, __m256i &acc1, __m256i &acc2) {
+    mul_acc_split_avx2(x, _mm256_srli_epi64(x, 32), y, acc0, acc1, acc2);
+}
+
+SIMD_TARGET_AVX2 static inline uint64_t horizontal_sum_avx2(__m256i x) {
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, x);
+    return modp_128((uint128_t)lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+}
+
+SIMD_TARGET_AVX2 uint64_t inner_productp_avx2(const uint64_t* a, const uint64_t* b, uint64_t size) {
+    // acc2 grows by < 2^59 per step, so 16 steps stay below 2^63
+    const uint64_t bound = 16 * 4;
+    uint64_t vec_end = size & ~3ULL;
+    __m256i sum = _mm256_setzero_si256();
+    uint64_t i = 0;
+    while(i < vec_end) {
+        uint64_t end = i + bound < vec_end ? i + bound : vec_end;
+        __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256(), acc2 = _mm256_setzero_si256();
+        for(; i < end; i += 4) {
+            mul_acc_avx2(_mm256_loadu_si256((__m256i*)(a + i)), _mm256_loadu_si256((__m256i*)(b + i)), acc0, acc1, acc2);
+        }
+        sum = reduce_avx2(_mm256_add_epi64(sum, reduce_partials_avx2(acc0, acc1, acc2)));
+    }
+    return add_modp(horizontal_sum_avx2(sum), inner_productp_scalar(a + i, b + i, size - i));
+}
+
+SIMD_TARGET_AVX2 uint64_t batch_add_modp_avx2(uint64_t* a, uint64_t* b, uint64_t size) {
+    // Sum the 32-bit halves separately so no lane can overflow
+    const __m256i low32 = _mm256_set1_epi64x(0xffffffffULL);
+    const uint64_t bound = (1ULL << 28) * 4;
+    uint64_t vec_end = size & ~3ULL;
+    __m256i sum = _mm256_setzero_si256();
+    uint64_t i = 0;
+    while(i < vec_end) {
+        uint64_t end = i + bound < vec_end ? i + bound : vec_end;
+        __m256i lo = _mm256_setzero_si256(), hi = _mm256_setzero_si256();
+        for(; i < end; i += 4) {
+            __m256i x = _mm256_loadu_si256((__m256i*)(a + i));
+            __m256i y = _mm256_loadu_si256((__m256i*)(b + i));
+            lo = _mm256_add_epi64(lo, _mm256_add_epi64(_mm256_and_si256(x, low32), _mm256_and_si256(y, low32)));
+            hi = _mm256_add_epi64(hi, _mm256_add_epi64(_mm256_srli_epi64(x, 32), _mm256_srli_epi64(y, 32)));
+        }
+        sum = reduce_avx2(_mm256_add_epi64(sum, reduce_partials_avx2(lo, hi, _mm256_setzero_si256())));
+    }
+    return add_modp(horizontal_sum_avx2(sum), batch_add_modp_scalar(a + i, b + i, size - i));
+}
+
+SIMD_TARGET_AVX2 uint64_t batch_sum_modp_avx2(uint64_t* a, uint64_t size) {
+    const __m256i low32 = _mm256_set1_epi64x(0xffffffffULL);
+    const uint64_t bound = (1ULL << 28) * 4;
+    uint64_t vec_end = size & ~3ULL;
+    __m256i sum = _mm256_setzero_si256();
+    uint64_t i = 0;
+    while(i < vec_end) {
+        uint64_t end = i + bound < vec_end ? i + bound : vec_end;
+        __m256i lo = _mm256_setzero_si256(), hi = _mm256_setzero_si256();
+        for(; i < end; i += 4) {
+            __m256i x = _mm256_loadu_si256((__m256i*)(a + i));
+            lo = _mm256_add_epi64(lo, _mm256_and_si256(x, low32));
+            hi = _mm256_add_epi64(hi, _mm256_srli_epi64(x, 32));
+        }
+        sum = reduce_avx2(_mm256_add_epi64(sum, reduce_partials_avx2(lo, hi, _mm256_setzero_si256())));
+    }
+    return add_modp(horizontal_sum_avx2(sum), batch_sum_modp_scalar(a + i, size - i));
+}
+
+SIMD_TARGET_AVX2 void batch_mul_modp_avx2(uint64_t* a, uint64_t* b, uint64_t* out, uint64_t size) {
+    uint64_t vec_end = size & ~3ULL;
+    uint64_t i = 0;
+    for(; i < vec_end; i += 4) {
+        __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256(), acc2 = _mm256_setzero_si256();
+        mul_acc_avx2(_mm256_loadu_si256((__m256i*)(a + i)), _mm256_loadu_si256((__m256i*)(b + i)), acc0, acc1, acc2);
+        _mm256_storeu_si256((__m256i*)(out + i), reduce_partials_avx2(acc0, acc1, acc2));
+    }
+    batch_mul_modp_scalar(a + i, b + i, out + i, size - i);
+}
+
+SIMD_TARGET_AVX2 static inline __m256i mul_modp_avx2(__m256i x, __m256i y) {
+    __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256(), acc2 = _mm256_setzero_si256();
+    mul_acc_avx2(x, y, acc0, acc1, acc2);
+    return reduce_partials_avx2(acc0, acc1, acc2);
+}
+
+// Sixteen chains in four vectors, each stepping by step^16
+SIMD_TARGET_AVX2 void powers_modp_avx2(uint64_t first, uint64_t step, uint64_t size, uint64_t* out) {
+    const uint64_t lanes = 16;
+    if (size < 2 * lanes) {
+        return powers_modp_scalar(first, step, size, out);
+    }
+    powers_modp_scalar(first, step, lanes, out);
+    __m256i v[4];
+    for(int c = 0; c < 4; c++) {
+        v[c] = _mm256_loadu_si256((__m256i*)(out + 4 * c));
+    }
+    __m256i s = _mm256_set1_epi64x(pow_modp(step, lanes));
+    uint64_t i = lanes;
+    for(; i + lanes <= size; i += lanes) {
+        for(int c = 0; c < 4; c++) {
+            v[c] = mul_modp_avx2(v[c], s);
+            _mm256_storeu_si256((__m256i*)(out + i + 4 * c), v[c]);
+        }
+    }
+    powers_modp_scalar(mul_modp(out[i - 1], step), step, size - i, out + i);
+}
+
+SIMD_TARGET_AVX2 uint64_t powers_inner_productp_avx2(const uint64_t* a, uint64_t first, uint64_t step, uint64_t size) {
+    const uint64_t lanes = 16;
+    if (size < lanes) {
+        return powers_inner_productp_scalar(a, first, step, size);
+    }
+    // acc2 grows by < 2^59 per step, so 16 steps (4 rounds of 4 vectors)
+    // stay below 2^63
+    const uint64_t bound = 4 * lanes;
+    uint64_t powers[lanes];
+    powers_modp_scalar(first, step, lanes, powers);
+    __m256i v[4];
+    for(int c = 0; c < 4; c++) {
+        v[c] = _mm256_loadu_si256((__m256i*)(powers + 4 * c));
+    }
+    __m256i s = _mm256_set1_epi64x(pow_modp(step, lanes));
+    uint64_t vec_end = size / lanes * lanes;
+    __m256i sum = _mm256_setzero_si256();
+    uint64_t i = 0;
+    while(i < vec_end) {
+        uint64_t end = i + bound < vec_end ? i + bound : vec_end;
+        __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256(), acc2 = _mm256_setzero_si256();
+        for(; i < end; i += lanes) {
+            for(int c = 0; c < 4; c++) {
+                mul_acc_avx2(_mm256_loadu_si256((__m256i*)(a + i + 4 * c)), v[c], acc0, acc1, acc2);
+                v[c] = mul_modp_avx2(v[c], s);
+            }
+        }
+        sum = reduce_avx2(_mm256_add_epi64(sum, reduce_partials_avx2(acc0, acc1, acc2)));
+    }
+    _mm256_storeu_si256((__m256i*)powers, v[0]);
+    return add_modp(horizontal_sum_avx2(sum), powers_inner_productp_scalar(a + i, powers[0], step, size - i));
+}
+
+SIMD_TARGET_AVX2 void fold_modp_avx2(uint64_t** rows, uint64_t* coeffs, uint64_t k, uint64_t offset, uint64_t size, uint64_t* out) {
+    uint64_t vec_end = size & ~3ULL;
+    uint64_t j = 0;
+    for(; j < vec_end; j += 4) {
+        __m256i sum = _mm256_setzero_si256();
+        for(int start = 0; start < k; start += 16) {
+            int end = start + 16 < k ? start + 16 : k;
+            __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256(), acc2 = _mm256_setzero_si256();
+            for(int l = start; l < end; l++) {
+                mul_acc_avx2(_mm256_set1_epi64x(coeffs[l]), _mm256_loadu_si256((__m256i*)(rows[l] + offset + j)), acc0, acc1, acc2);
+            }
+            sum = reduce_avx2(_mm256_add_epi64(sum, reduce_partials_avx2(acc0, acc1, acc2)));
+        }
+        _mm256_storeu_si256((__m256i*)(out + j), sum);
+    }
+    fold_modp_scalar(rows, coeffs, k, offset + j, size - j, out + j);
+}
+
+// Any 64-bit lane to [0, PR)
+SIMD_TARGET_IFMA static inline __m512i reduce_ifma(__m512i x) {
+    const __m512i pr = _mm512_set1_epi64(PR);
+    x = _mm512_add_epi64(_mm512_srli_epi64(x, PRIME_EXP), _mm512_and_si512(x, pr));
+    return _mm512_mask_sub_epi64(x, _mm512_cmpge_epu64_mask(x, pr), x, pr);
+}
+
+// acc0 + acc1 * 2^52 + acc2 * 2^104 to [0, PR), with 2^104 = 2^43 and 2^61 = 1
+SIMD_TARGET_IFMA static inline __m512i reduce_partials_ifma(__m512i acc0, __m512i acc1, __m512i acc2) {
+    const __m512i pr = _mm512_set1_epi64(PR);
+    __m512i low9 = _mm512_set1_epi64((1ULL << 9) - 1);
+    __m512i low18 = _mm512_set1_epi64((1ULL << 18) - 1);
+    __m512i x = _mm512_add_epi64(_mm512_srli_epi64(acc0, PRIME_EXP), _mm512_and_si512(acc0, pr));
+    x = _mm512_add_epi64(x, _mm512_srli_epi64(acc1, 9));
+    x = _mm512_add_epi64(x, _mm512_slli_epi64(_mm512_and_si512(acc1, low9), 52));
+    x = _mm512_add_epi64(x, _mm512_srli_epi64(acc2, 18));
+    x = _mm512_add_epi64(x, _mm512_slli_epi64(_mm512_and_si512(acc2, low18), 43));
+    return reduce_ifma(x);
+}
+
+// Adds the 52-bit partial products of x * y into the three accumulators, x
+// given as its low 52 bits xl and the rest xh. Each call adds less than 2^52
+// to acc0 and less than 3 * 2^52 to acc1, acc2.
+SIMD_TARGET_IFMA static inline void mul_acc_split_ifma(__m512i xl, __m512i xh, __m512i y, __m512i &acc0, __m512i &acc1, __m512i &acc2) {
+    const __m512i low52 = _mm512_set1_epi64((1ULL << 52) - 1);
+    __m512i yl = _mm512_and_si512(y, low52), yh = _mm512_srli_epi64(y, 52);
+    acc0 = _mm512_madd52lo_epu64(acc0, xl, yl);
+    acc1 = _mm512_madd52hi_epu64(acc1, xl, yl);
+    acc1 = _mm512_madd52lo_epu64(acc1, xh, yl);
+    acc1 = _mm512_madd52lo_epu64(acc1, xl, yh);
+    acc2 = _mm512_madd52hi_epu64(acc2, xh, yl);
+    acc2 = _mm512_madd52hi_epu64(acc2, xl, yh);
+    acc2 = _mm512_madd52lo_epu64(acc2, xh, yh);
+}
+
+SIMD_TARGET_IFMA static inline void mul_acc_ifma(__m512i x, __m512i y, __m512i &acc0, __m512i &acc1, __m512i &acc2) {
+    const __m512i low52 = _mm512_set1_epi64((1ULL << 52) - 1);
+    mul_acc_split_ifma(_mm512_and_si512(x, low52), _mm512_srli_epi64(x, 52), y, acc0, acc1, acc2);
+}
+
+SIMD_TARGET_IFMA static inline uint64_t horizontal_sum_ifma(__m512i x) {
+    uint64_t lanes[8];
+    _mm512_storeu_si512((void*)lanes, x);
+    uint128_t sum = 0;
+    for(int i = 0; i < 8; i++) {
+        sum += lanes[i];
+    }
+    return modp_128(sum);
+}
+
+SIMD_TARGET_IFMA uint64_t inner_productp_ifma(const uint64_t* a, const uint64_t* b, uint64_t size) {
+    // acc1 and acc2 grow by < 3 * 2^52 per step, so 1024 steps stay below 2^64
+    const uint64_t bound = 1024 * 8;
+    uint64_t vec_end = size & ~7ULL;
+    __m512i sum = _mm512_setzero_si512();
+    uint64_t i = 0;
+    while(i < vec_end) {
+        uint64_t end = i + bound < vec_end ? i + bound : vec_end;
+        __m512i acc0 = _mm512_setzero_si512(), acc1 = _mm512_setzero_si512(), acc2 = _mm512_setzero_si512();
+        for(; i < end; i += 8) {
+            mul_acc_ifma(_mm512_loadu_si512((void*)(a + i)), _mm512_loadu_si512((void*)(b + i)), acc0, acc1, acc2);
+        }
+        sum = reduce_ifma(_mm512_add_epi64(sum, reduce_partials_ifma(acc0, acc1, acc2)));
+    }
+    return add_modp(horizontal_sum_ifma(sum), inner_productp_scalar(a + i, b + i, size - i));
+}
+
+SIMD_TARGET_IFMA void batch_mul_modp_ifma(uint64_t* a, uint64_t* b, uint64_t* out, uint64_t size) {
+    uint64_t vec_end = size & ~7ULL;
+    uint64_t i = 0;
+    for(; i < vec_end; i += 8) {
+        __m512i acc0 = _mm512_setzero_si512(), acc1 = _mm512_setzero_si512(), acc2 = _mm512_setzero_si512();
+        mul_acc_ifma(_mm512_loadu_si512((void*)(a + i)), _mm512_loadu_si512((void*)(b + i)), acc0, acc1, acc2);
+        _mm512_storeu_si512((void*)(out + i), reduce_partials_ifma(acc0, acc1, acc2));
+    }
+    batch_mul_modp_scalar(a + i, b + i, out + i, size - i);
+}
+
+SIMD_TARGET_IFMA static inline __m512i mul_modp_ifma(__m512i x, __m512i y) {
+    __m512i acc0 = _mm512_setzero_si512(), acc1 = _mm512_setzero_si512(), acc2 = _mm512_setzero_si512();
+    mul_acc_ifma(x, y, acc0, acc1, acc2);
+    return reduce_partials_ifma(acc0, acc1, acc2);
+}
+
+// Thirty-two chains in four vectors, each stepping by step^32
+SIMD_TARGET_IFMA void powers_modp_ifma(uint64_t first, uint64_t step, uint64_t size, uint64_t* out) {
+    const uint64_t lanes = 32;
+    if (size < 2 * lanes) {
+        return powers_modp_scalar(first, step, size, out);
+    }
+    powers_modp_scalar(first, step, lanes, out);
+    __m512i v[4];
+    for(int c = 0; c < 4; c++) {
+        v[c] = _mm512_loadu_si512((void*)(out + 8 * c));
+    }
+    __m512i s = _mm512_set1_epi64(pow_modp(step, lanes));
+    uint64_t i = lanes;
+    for(; i + lanes <= size; i += lanes) {
+        for(int c = 0; c < 4; c++) {
+            v[c] = mul_modp_ifma(v[c], s);
+            _mm512_storeu_si512((void*)(out + i + 8 * c), v[c]);
+        }
+    }
+    powers_modp_scalar(mul_modp(out[i - 1], step), step, size - i, out + i);
+}
+
+SIMD_TARGET_IFMA uint64_t powers_inner_productp_ifma(const uint64_t* a, uint64_t first, uint64_t step, uint64_t size) {
+    const uint64_t lanes = 32;
+    if (size < lanes) {
+        return powers_inner_productp_scalar(a, first, step, size);
+    }
+    // acc1 and acc2 grow by < 3 * 2^52 per step, so 1024 steps (256 rounds of
+    // 4 vectors) stay below 2^64
+    const uint64_t bound = 256 * lanes;
+    uint64_t powers[lanes];
+    powers_modp_scalar(first, step, lanes, powers);
+    __m512i v[4];
+    for(int c = 0; c < 4; c++) {
+        v[c] = _mm512_loadu_si512((void*)(powers + 8 * c));
+    }
+    __m512i s = _mm512_set1_epi64(pow_modp(step, lanes));
+    uint64_t vec_end = size / lanes * lanes;
+    __m512i sum = _mm512_setzero_si512();
+    uint64_t i = 0;
+    while(i < vec_end) {
+        uint64_t end = i + bound < vec_end ? i + bound : vec_end;
+        __m512i acc0 = _mm512_setzero_si512(), acc1 = _mm512_setzero_si512(), acc2 = _mm512_setzero_si512();
+        for(; i < end; i += lanes) {
+            for(int c = 0; c < 4; c++) {
+                mul_acc_ifma(_mm512_loadu_si512((void*)(a + i + 8 * c)), v[c], acc0, acc1, acc2);
+                v[c] = mul_modp_ifma(v[c], s);
+            }
+        }
+        sum = reduce_ifma(_mm512_add_epi64(sum, reduce_partials_ifma(acc0, acc1, acc2)));
+    }
+    _mm512_storeu_si512((void*)powers, v[0]);
+    return add_modp(horizontal_sum_ifma(sum), powers_inner_productp_scalar(a + i, powers[0], step, size - i));
+}
+
+SIMD_TARGET_IFMA void fold_modp_ifma(uint64_t** rows, uint64_t* coeffs, uint64_t k, uint64_t offset, uint64_t size, uint64_t* out) {
+    uint64_t vec_end = size & ~7ULL;
+    uint64_t j = 0;
+    for(; j < vec_end; j += 8) {
+        __m512i sum = _mm512_setzero_si512();
+        for(int start = 0; start < k; start += 1024) {
+            int end = start + 1024 < k ? start + 1024 : k;
+            __m512i acc0 = _mm512_setzero_si512(), acc1 = _mm512_setzero_si512(), acc2 = _mm512_setzero_si512();
+            for(int l = start; l < end; l++) {
+                mul_acc_ifma(_mm512_set1_epi64(coeffs[l]), _mm512_loadu_si512((void*)(rows[l] + offset + j)), acc0, acc1, acc2);
+            }
+            sum = reduce_ifma(_mm512_add_epi64(sum, reduce_partials_ifma(acc0, acc1, acc2)));
+        }
+        _mm512_storeu_si512((void*)(out + j), sum);
+    }
+    fold_modp_scalar(rows, coeffs, k, offset + j, size - j, out + j);
+}
+
+// fold_modp_avx2() for k = K <= 16: the coefficients are broadcast and split
+// once, and two vectors of positions are in flight so that the products of
+// one hide the latency of the other
+template<int K>
+SIMD_TARGET_AVX2 void fold_modp_fixed_avx2(uint64_t** rows, const uint64_t* coeffs, uint64_t offset, uint64_t size, uint64_t* out) {
+    __m256i c[K], ch[K];
+    const uint64_t* r[K];
+    for(int l = 0; l < K; l++) {
+        c[l] = _mm256_set1_epi64x(coeffs[l]);
+        ch[l] = _mm256_set1_epi64x(coeffs[l] >> 32);
+        r[l] = rows[l] + offset;
+    }
+    uint64_t vec_end = size & ~7ULL;
+    uint64_t j = 0;
+    for(; j < vec_end; j += 8) {
+        __m256i a0 = _mm256_setzero_si256(), a1 = _mm256_setzero_si256(), a2 = _mm256_setzero_si256();
+        __m256i b0 = _mm256_setzero_si256(), b1 = _mm256_setzero_si256(), b2 = _mm256_setzero_si256();
+        for(int l = 0; l < K; l++) {
+            mul_acc_split_avx2(c[l], ch[l], _mm256_loadu_si256((__m256i*)(r[l] + j)), a0, a1, a2);
+            mul_acc_split_avx2(c[l], ch[l], _mm256_loadu_si256((__m256i*)(r[l] + j + 4)), b0, b1, b2);
+        }
+        _mm256_storeu_si256((__m256i*)(out + j), reduce_partials_avx2(a0, a1, a2));
+        _mm256_storeu_si256((__m256i*)(out + j + 4), reduce_partials_avx2(b0, b1, b2));
+    }
+    fold_modp_fixed_scalar<K>(rows, coeffs, offset + j, size - j, out + j);
+}
+
+// fold_modp_ifma() for k = K <= 16, in the same way
+template<int K>
+SIMD_TARGET_IFMA void fold_modp_fixed_ifma(uint64_t** rows, const uint64_t* coeffs, uint64_t offset, uint64_t size, uint64_t* out) {
+    __m512i cl[K], ch[K];
+    const uint64_t* r[K];
+    for(int l = 0; l < K; l++) {
+        cl[l] = _mm512_set1_epi64(coeffs[l] & ((1ULL << 52) - 1));
+        ch[l] = _mm512_set1_epi64(coeffs[l] >> 52);
+        r[l] = rows[l] + offset;
+    }
+    uint64_t vec_end = size & ~15ULL;
+    uint64_t j = 0;
+    for(; j < vec_end; j += 16) {
+        __m512i a0 = _mm512_setzero_si512(), a1 = _mm512_setzero_si512(), a2 = _mm512_setzero_si512();
+        __m512i b0 = _mm512_setzero_si512(), b1 = _mm512_setzero_si512(), b2 = _mm512_setzero_si512();
+        for(int l = 0; l < K; l++) {
+            mul_acc_split_ifma(cl[l], ch[l], _mm512_loadu_si512((void*)(r[l] + j)), a0, a1, a2);
+            mul_acc_split_ifma(cl[l], ch[l], _mm512_loadu_si512((void*)(r[l] + j + 8)), b0, b1, b2);
+        }
+        _mm512_storeu_si512((void*)(out + j), reduce_partials_ifma(a0, a1, a2));
+        _mm512_storeu_si512((void*)(out + j + 8), reduce_partials_ifma(b0, b1, b2));
+    }
+    fold_modp_fixed_scalar<K>(rows, coeffs, offset + j, size - j, out + j);
+}
+
+// inner_product_matrixp() for even k = K: each 2x2 block of products is
+// formed in one pass over a tile, so every vector loaded feeds two products,
+// and the K * K sums stay in vectors until the end of the call
+template<int K>
+SIMD_TARGET_AVX2 void inner_product_matrixp_fixed_avx2(uint64_t** a, uint64_t** b, uint64_t offset, uint64_t size, uint64_t* out) {
+    // acc2 grows by < 2^59 per step, so 16 steps stay below 2^63
+    const uint64_t bound = 16 * 4;
+    const uint64_t tile = 2048 / K < 64 ? 64 : 2048 / K / 8 * 8;
+    uint64_t vec_end = size & ~3ULL;
+    __m256i sums[K * K];
+    for(int i = 0; i < K * K; i++) {
+        sums[i] = _mm256_setzero_si256();
+    }
+    for(uint64_t start = 0; start < vec_end; start += tile) {
+        uint64_t end = start + tile < vec_end ? start + tile : vec_end;
+        for(int i = 0; i < K; i += 2) {
+            const uint64_t* a0 = a[i] + offset;
+            const uint64_t* a1 = a[i + 1] + offset;
+            for(int j = 0; j < K; j += 2) {
+                const uint64_t* b0 = b[j] + offset;
+                const uint64_t* b1 = b[j + 1] + offset;
+                for(uint64_t t = start; t < end; ) {
+                    uint64_t stop = t + bound < end ? t + bound : end;
+                    __m256i acc[4][3];
+                    for(int p = 0; p < 4; p++) {
+                        acc[p][0] = acc[p][1] = acc[p][2] = _mm256_setzero_si256();
+                    }
+                    for(; t < stop; t += 4) {
+                        __m256i x0 = _mm256_loadu_si256((__m256i*)(a0 + t)), x1 = _mm256_loadu_si256((__m256i*)(a1 + t));
+                        __m256i y0 = _mm256_loadu_si256((__m256i*)(b0 + t)), y1 = _mm256_loadu_si256((__m256i*)(b1 + t));
+                        __m256i x0h = _mm256_srli_epi64(x0, 32), x1h = _mm256_srli_epi64(x1, 32);
+                        mul_acc_split_avx2(x0, x0h, y0, acc[0][0], acc[0][1], acc[0][2]);
+                        mul_acc_split_avx2(x0, x0h, y1, acc[1][0], acc[1][1], acc[1][2]);
+                        mul_acc_split_avx2(x1, x1h, y0, acc[2][0], acc[2][1], acc[2][2]);
+                        mul_acc_split_avx2(x1, x1h, y1, acc[3][0], acc[3][1], acc[3][2]);
+                    }
+                    for(int p = 0; p < 4; p++) {
+                        __m256i& sum = sums[(i + p / 2) * K + j + p % 2];
+                        sum = reduce_avx2(_mm256_add_epi64(sum, reduce_partials_avx2(acc[p][0], acc[p][1], acc[p][2])));
+                    }
+                }
+            }
+        }
+    }
+    for(int i = 0; i < K; i++) {
+        for(int j = 0; j < K; j++) {
+            uint64_t tail = inner_productp_scalar(a[i] + offset + vec_end, b[j] + offset + vec_end, size - vec_end);
+            out[i * K + j] = add_modp(horizontal_sum_avx2(sums[i * K + j]), tail);
+        }
+    }
+}
+
+template<int K>
+SIMD_TARGET_IFMA void inner_product_matrixp_fixed_ifma(uint64_t** a, uint64_t** b, uint64_t offset, uint64_t size, uint64_t* out) {
+    // A tile is at most 128 steps, below the 1024 that acc1 and acc2 allow
+    const __m512i low52 = _mm512_set1_epi64((1ULL << 52) - 1);
+    const uint64_t tile = 2048 / K < 64 ? 64 : 2048 / K / 8 * 8;
+    uint64_t vec_end = size & ~7ULL;
+    __m512i sums[K * K];
+    for(int i = 0; i < K * K; i++) {
+        sums[i] = _mm512_setzero_si512();
+    }
+    for(uint64_t start = 0; start < vec_end; start += tile) {
+        uint64_t end = start + tile < vec_end ? start + tile : vec_end;
+        for(int i = 0; i < K; i += 2) {
+            const uint64_t* a0 = a[i] + offset;
+            const uint64_t* a1 = a[i + 1] + offset;
+            for(int j = 0; j < K; j += 2) {
+                const uint64_t* b0 = b[j] + offset;
+                const uint64_t* b1 = b[j + 1] + offset;
+                __m512i acc[4][3];
+                for(int p = 0; p < 4; p++) {
+                    acc[p][0] = acc[p][1] = acc[p][2] = _mm512_setzero_si512();
+                }
+                for(uint64_t t = start; t < end; t += 8) {
+                    __m512i x0 = _mm512_loadu_si512((void*)(a0 + t)), x1 = _mm512_loadu_si512((void*)(a1 + t));
+                    __m512i y0 = _mm512_loadu_si512((void*)(b0 + t)), y1 = _mm512_loadu_si512((void*)(b1 + t));
+                    __m512i x0l = _mm512_and_si512(x0, low52), x0h = _mm512_srli_epi64(x0, 52);
+                    __m512i x1l = _mm512_and_si512(x1, low52), x1h = _mm512_srli_epi64(x1, 52);
+                    mul_acc_split_ifma(x0l, x0h, y0, acc[0][0], acc[0][1], acc[0][2]);
+                    mul_acc_split_ifma(x0l, x0h, y1, acc[1][0], acc[1][1], acc[1][2]);
+                    mul_acc_split_ifma(x1l, x1h, y0, acc[2][0], acc[2][1], acc[2][2]);
+                    mul_acc_split_ifma(x1l, x1h, y1, acc[3][0], acc[3][1], acc[3][2]);
+                }
+                for(int p = 0; p < 4; p++) {
+                    __m512i& sum = sums[(i + p / 2) * K + j + p % 2];
+                    sum = reduce_ifma(_mm512_add_epi64(sum, reduce_partials_ifma(acc[p][0], acc[p][1], acc[p][2])));
+                }
+            }
+        }
+    }
+    for(int i = 0; i < K; i++) {
+        for(int j = 0; j < K; j++) {
+            uint64_t tail = inner_productp_scalar(a[i] + offset + vec_end, b[j] + offset + vec_end, size - vec_end);
+            out[i * K + j] = add_modp(horizontal_sum_ifma(sums[i * K + j]), tail);
+        }
+    }
+}
+#endif
@@ -0,0 +1,153 @@
+#pragma once
+#include "arithmetic.h"
+#include "polynomial.h"
+#include<map>
+#include<memory>
+#include<mutex>
+#include<vector>
+
+using namespace std;
+
+// Lagrange basis L_0..L_{n-1} over the nodes 0..n-1. The barycentric weights
+// w_j = 1 / prod_{l != j} (j - l) are computed once, so that
+//     L_j(r) = prod_l (r - l) * w_j / (r - j)
+// costs O(n) multiplications and one inversion for any r.
+//
+// At the points n + i the factor 1 / (n + i - j) only depends on i - j, so
+// extending values at 0..n-1 to n..2n-2 is a Toeplitz product, which
+// extend_scaled() evaluates with a Karatsuba middle product.
+class LagrangeTable {
+public:
+    explicit LagrangeTable(uint64_t n) : n(n), weights(n), bases(n - 1, vector<uint64_t>(n)), node_values(n - 1) {
+        // prod_{l != j} (j - l) = j! * (-1)^(n - 1 - j) * (n - 1 - j)!
+        vector<uint64_t> factorial(2 * n);
+        factorial[0] = 1;
+        for(int i = 1; i < 2 * n; i++) {
+            factorial[i] = mul_modp(factorial[i - 1], i);
+        }
+        for(int j = 0; j < n; j++) {
+            weights[j] = mul_modp(factorial[j], factorial[n - 1 - j]);
+            if ((n - 1 - j) % 2 == 1) {
+                weights[j] = neg_modp(weights[j]);
+            }
+        }
+        batch_inverse(weights.data(), n, weights.data());
+
+        // bases[i][j] = L_j(n + i), with n + i - j in [1, 2n - 2]
+        vector<uint64_t> inverses(2 * n - 1);
+        for(int d = 0; d < 2 * n - 1; d++) {
+            inverses[d] = d == 0 ? 1 : d;
+        }
+        batch_inverse(inverses.data(), 2 * n - 1, inverses.data());
+        for(int i = 0; i < n - 1; i++) {
+            // prod_l (n + i - l) = (n + i)! / i!
+            node_values[i] = mul_modp(factorial[n + i], inverse(factorial[i]));
+            for(int j = 0; j < n; j++) {
+                bases[i][j] = mul_modp(node_values[i], mul_modp(weights[j], inverses[n + i - j]));
+            }
+        }
+
+        // toeplitz[q] = 1 / (q + n - width + 1), or 0 outside [1, 2n - 2]
+        width = 1;
+        while(width < n) {
+            width *= 2;
+        }
+        toeplitz.assign(2 * width - 1, 0);
+        for(int q = 0; q < 2 * width - 1; q++) {
+            int64_t d = q + (int64_t) n - (int64_t) width + 1;
+            if (d >= 1 && d <= 2 * (int64_t) n - 2) {
+                toeplitz[q] = inverses[d];
+            }
+        }
+    }
+
+    uint64_t size() const {
+        return n;
+    }
+
+    // Row i holds L_0(n + i)..L_{n-1}(n + i), for i < n - 1: it maps the values
+    // of a degree < n polynomial at 0..n-1 to its value at n + i
+    const vector< vector<uint64_t> >& extension_bases() const {
+        return bases;
+    }
+
+    // prod_l (n + i - l) for i < n - 1
+    const vector<uint64_t>& extension_scale() const {
+        return node_values;
+    }
+
+    uint64_t extension_scratch_size() const {
+        return 7 * width;
+    }
+
+    // out[i] = f(n + i) / prod_l (n + i - l) for i < n - 1, where f is the
+    // degree < n polynomial with f(j) = values[j]. Costs O(n^1.58).
+    void extend_scaled(const uint64_t* values, uint64_t* out, uint64_t* scratch) const {
+        uint64_t* weighted = scratch;
+        uint64_t* product = scratch + width;
+        for(int j = 0; j < width; j++) {
+            weighted[j] = j < n ? mul_modp(weights[j], values[j]) : 0;
+        }
+        middle_product(weighted, toeplitz.data(), width, product, scratch + 2 * width);
+        for(int i = 0; i < n - 1; i++) {
+            out[i] = product[i];
+        }
+    }
+
+    // out[j] = L_j(r) for j < n
+    void evaluate(uint64_t r, uint64_t* out) const {
+        r = modp(r);
+        if (r < n) {
+            for(int j = 0; j < n; j++) {
+                out[j] = j == r ? 1 : 0;
+            }
+            return;
+        }
+        // out holds the prefix products of (r - j) until the backward pass
+        // turns them into L_j(r) = node_poly * weights[j] / (r - j), so the
+        // evaluation needs no scratch memory
+        out[0] = r;
+        for(int j = 1; j < n; j++) {
+            out[j] = mul_modp(out[j - 1], sub_modp(r, j));
+        }
+        uint64_t node_poly = out[n - 1];
+        uint64_t inv = inverse(node_poly);
+        for(int j = n - 1; j > 0; j--) {
+            out[j] = mul_modp(node_poly, mul_modp(weights[j], mul_modp(inv, out[j - 1])));
+            inv = mul_modp(inv, sub_modp(r, j));
+        }
+        out[0] = mul_modp(node_poly, mul_modp(weights[0], inv));
+    }
+
+    vector<uint64_t> evaluate(uint64_t r) const {
+        vector<uint64_t> out(n);
+        evaluate(r, out.data());
+        return out;
+    }
+
+private:
+    uint64_t n;
+    uint64_t width;
+    vector<uint64_t> weights;
+    vector< vector<uint64_t> > bases;
+    vector<uint64_t> node_values;
+    vector<uint64_t> toeplitz;
+};
+
+// Tables for every n in use, built on first request and shared by the
+// prover and verifiers. Safe to use from several threads.
+class LagrangeCache {
+public:
+    const LagrangeTable& get(uint64_t n) {
+        unique_lock<mutex> lock(mtx);
+        unique_ptr<LagrangeTable>& table = tables[n];
+        if (!table) {
+            table.reset(new LagrangeTable(n));
+        }
+        return *table;
+    }
+
+private:
+    mutex mtx;
+    map<uint64_t, unique_ptr<LagrangeTable> > tables;
+};
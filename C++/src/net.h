@@ -0,0 +1,248 @@
+#pragma once
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+// Largest message a channel takes by default; the messages of a proof are
+// shares, challenge halves and VerMsgs of O(k) field elements, far below it
+const uint64_t MAX_MESSAGE_BYTES = 1 << 20;
+
+// Messages between two parties over a connected stream socket. Each message
+// is its length as 8 bytes little endian followed by its bytes. send() only
+// queues the message and returns; a thread of the channel writes it out, so
+// a party keeps computing while its messages are on the wire. recv() blocks
+// until the next message is in. A channel owns its socket. The peer may be
+// malicious, so recv() refuses a message longer than max_message instead of
+// allocating whatever its length prefix asks for.
+class Channel {
+public:
+    explicit Channel(int fd, uint64_t max_message = MAX_MESSAGE_BYTES) : fd(fd), max_message(max_message) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        sender = thread([this] { send_loop(); });
+    }
+
+    Channel(const Channel&) = delete;
+    Channel& operator=(const Channel&) = delete;
+
+    // Waits for the queued messages to go out
+    ~Channel() {
+        {
+            unique_lock<mutex> lock(mtx);
+            closing = true;
+        }
+        wake.notify_all();
+        sender.join();
+        close(fd);
+    }
+
+    void send(vector<uint8_t> message) {
+        {
+            unique_lock<mutex> lock(mtx);
+            queue.push_back(move(message));
+        }
+        wake.notify_all();
+    }
+
+    void send(const uint8_t* data, uint64_t size) {
+        send(vector<uint8_t>(data, data + size));
+    }
+
+    // Waits until every queued message is written
+    void flush() {
+        unique_lock<mutex> lock(mtx);
+        drained.wait(lock, [this] { return (queue.empty() && !writing) || failed; });
+    }
+
+    // Prints the reason and returns false if the peer is gone
+    bool recv(vector<uint8_t>& message) {
+        uint8_t prefix[8];
+        if (!read_all(prefix, 8)) {
+            cout << "Channel closed by the peer" << endl;
+            return false;
+        }
+        uint64_t size = 0;
+        for(int i = 7; i >= 0; i--) {
+            size = (size << 8) | prefix[i];
+        }
+        if (size > max_message) {
+            cout << "Peer sent a message of " << size << " bytes, more than " << max_message << endl;
+            return false;
+        }
+        message.resize(size);
+        if (!read_all(message.data(), size)) {
+            cout << "Channel closed in the middle of a message" << endl;
+            return false;
+        }
+        received += 8 + size;
+        return true;
+    }
+
+    // Bytes on the wire, length prefixes included
+    uint64_t bytes_sent() const {
+        return sent;
+    }
+
+    uint64_t bytes_received() const {
+        return received;
+    }
+
+private:
+    void send_loop() {
+        while(true) {
+            vector<uint8_t> message;
+            {
+                unique_lock<mutex> lock(mtx);
+                writing = false;
+                drained.notify_all();
+                wake.wait(lock, [this] { return closing || !queue.empty(); });
+                if (queue.empty()) return;
+                message = move(queue.front());
+                queue.pop_front();
+                writing = true;
+            }
+            uint8_t prefix[8];
+            for(int i = 0; i < 8; i++) {
+                prefix[i] = (uint64_t)message.size() >> (8 * i);
+            }
+            if (!write_all(prefix, 8) || !write_all(message.data(), message.size())) {
+                cout << "Could not send " << message.size() << " bytes" << endl;
+                unique_lock<mutex> lock(mtx);
+                failed = true;
+                drained.notify_all();
+                return;
+            }
+            sent += 8 + message.size();
+        }
+    }
+
+    bool write_all(const uint8_t* data, uint64_t size) {
+        while(size > 0) {
+            ssize_t n = ::send(fd, data, size, MSG_NOSIGNAL);
+            if (n <= 0) return false;
+            data += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    bool read_all(uint8_t* data, uint64_t size) {
+        while(size > 0) {
+            ssize_t n = ::recv(fd, data, size, 0);
+            if (n <= 0) return false;
+            data += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    int fd;
+    uint64_t max_message;
+    thread sender;
+    mutex mtx;
+    condition_variable wake, drained;
+    deque< vector<uint8_t> > queue;
+    bool closing = false;
+    bool writing = false;
+    bool failed = false;
+    atomic<uint64_t> sent{0}, received{0};
+};
+
+const uint64_t NUM_PARTIES = 3;
+
+// Connects party to every other party over TCP on localhost: party i listens
+// on base_port + i and accepts the parties above it, and connects to the
+// parties below it, retrying while they start up, then sends its id.
+// channels[i] is left empty for i == party. Prints the reason and returns
+// false on failure.
+bool connect_parties(uint64_t party, uint64_t base_port, unique_ptr<Channel> channels[NUM_PARTIES]) {
+    int listener = -1;
+    if (party + 1 < NUM_PARTIES) {
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(base_port + party);
+        if (bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, NUM_PARTIES) != 0) {
+            cout << "Party " << party << " cannot listen on port " << base_port + party << endl;
+            close(listener);
+            return false;
+        }
+    }
+    for(uint64_t peer = 0; peer < party; peer++) {
+        int fd = -1;
+        for(int attempt = 0; attempt < 500 && fd < 0; attempt++) {
+            fd = socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in address = {};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            address.sin_port = htons(base_port + peer);
+            if (connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+                close(fd);
+                fd = -1;
+                this_thread::sleep_for(chrono::milliseconds(10));
+            }
+        }
+        if (fd < 0) {
+            cout << "Party " << party << " cannot reach party " << peer << endl;
+            close(listener);
+            return false;
+        }
+        uint8_t id = party;
+        if (::send(fd, &id, 1, MSG_NOSIGNAL) != 1) {
+            cout << "Party " << party << " cannot reach party " << peer << endl;
+            close(fd);
+            close(listener);
+            return false;
+        }
+        channels[peer].reset(new Channel(fd));
+    }
+    for(uint64_t n = party + 1; n < NUM_PARTIES; n++) {
+        int fd = accept(listener, nullptr, nullptr);
+        uint8_t id = 0;
+        if (fd < 0 || ::recv(fd, &id, 1, MSG_WAITALL) != 1 || id <= party || id >= NUM_PARTIES || channels[id]) {
+            cout << "Party " << party << " got a bad connection" << endl;
+            if (fd >= 0) close(fd);
+            close(listener);
+            return false;
+        }
+        channels[id].reset(new Channel(fd));
+    }
+    if (listener >= 0) {
+        close(listener);
+    }
+    return true;
+}
+
+// Channels between NUM_PARTIES parties in one process, over socket pairs;
+// channels[i][j] is party i's end of its channel to party j
+bool connect_local(unique_ptr<Channel> channels[NUM_PARTIES][NUM_PARTIES]) {
+    for(uint64_t i = 0; i < NUM_PARTIES; i++) {
+        for(uint64_t j = i + 1; j < NUM_PARTIES; j++) {
+            int fds[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+                cout << "Cannot create a socket pair" << endl;
+                return false;
+            }
+            channels[i][j].reset(new Channel(fds[0]));
+            channels[j][i].reset(new Channel(fds[1]));
+        }
+    }
+    return true;
+}
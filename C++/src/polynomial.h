@@ -0,0 +1,47 @@
+#pragma once
+#include "arithmetic.h"
+
+// out[i] = sum of a[j] * b[i + n - 1 - j] over j < n, for i < n, where b has
+// 2n - 1 entries. This "middle product" is the part of a * b a Toeplitz
+// matrix-vector product needs; the transposed Karatsuba split computes it with
+// three half-size middle products per level instead of n^2 multiplications.
+// n must be a power of two; scratch needs 5n entries and must not alias out.
+void middle_product(const uint64_t* a, const uint64_t* b, uint64_t n, uint64_t* out, uint64_t* scratch) {
+    if (n <= 16) {
+        for(int i = 0; i < n; i++) {
+            uint128_t acc = 0;
+            for(int j = 0; j < n; j++) {
+                acc += ((uint128_t) a[j]) * ((uint128_t) b[i + n - 1 - j]);
+            }
+            out[i] = modp_128(acc);
+        }
+        return;
+    }
+    // With a = (a0, a1) and b0, b1, b2 the windows of b starting at 0, h, 2h:
+    //   out_lo = MP(a0 + a1, b1) + MP(a1, b0 - b1)
+    //   out_hi = MP(a0 + a1, b1) - MP(a0, b1 - b2)
+    uint64_t h = n / 2;
+    uint64_t* sum_a = scratch;
+    uint64_t* diff_b = scratch + h;
+    uint64_t* common = scratch + 3 * h;
+    uint64_t* part = scratch + 4 * h;
+    uint64_t* next = scratch + 5 * h;
+    for(int j = 0; j < h; j++) {
+        sum_a[j] = add_modp(a[j], a[h + j]);
+    }
+    middle_product(sum_a, b + h, h, common, next);
+    for(int q = 0; q < 2 * h - 1; q++) {
+        diff_b[q] = sub_modp(b[q], b[h + q]);
+    }
+    middle_product(a + h, diff_b, h, part, next);
+    for(int i = 0; i < h; i++) {
+        out[i] = add_modp(common[i], part[i]);
+    }
+    for(int q = 0; q < 2 * h - 1; q++) {
+        diff_b[q] = sub_modp(b[h + q], b[2 * h + q]);
+    }
+    middle_product(a, diff_b, h, part, next);
+    for(int i = 0; i < h; i++) {
+        out[h + i] = sub_modp(common[i], part[i]);
+    }
+}
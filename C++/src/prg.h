@@ -0,0 +1,211 @@
+#pragma once
+#include "arithmetic.h"
+#include <cstring>
+
+using namespace std;
+
+// ChaCha20 keystream in the original layout: words 12-13 are a 64-bit block
+// counter and words 14-15 a 64-bit stream id, so one key gives 2^64
+// independent streams. Blocks are serialized little endian.
+
+inline uint32_t rotl32(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+#define CHACHA_QUARTER_ROUND(a, b, c, d) \
+    a += b; d = rotl32(d ^ a, 16); \
+    c += d; b = rotl32(b ^ c, 12); \
+    a += b; d = rotl32(d ^ a, 8); \
+    c += d; b = rotl32(b ^ c, 7);
+
+// Initial state for key (32 bytes), block counter and stream
+void chacha20_init(const uint8_t* key, uint64_t counter, uint64_t stream, uint32_t* state) {
+    state[0] = 0x61707865;
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    for(int i = 0; i < 8; i++) {
+        state[4 + i] = (uint32_t)key[4 * i] | ((uint32_t)key[4 * i + 1] << 8) | ((uint32_t)key[4 * i + 2] << 16) | ((uint32_t)key[4 * i + 3] << 24);
+    }
+    state[12] = (uint32_t)counter;
+    state[13] = (uint32_t)(counter >> 32);
+    state[14] = (uint32_t)stream;
+    state[15] = (uint32_t)(stream >> 32);
+}
+
+// Writes blocks counter, counter + 1, ... of the state's stream, 16 words each
+void chacha20_blocks_scalar(const uint32_t* state, uint64_t counter, uint64_t count, uint32_t* out) {
+    for(uint64_t b = 0; b < count; b++) {
+        uint32_t input[16], x[16];
+        memcpy(input, state, sizeof(input));
+        input[12] = (uint32_t)(counter + b);
+        input[13] = (uint32_t)((counter + b) >> 32);
+        memcpy(x, input, sizeof(x));
+        for(int round = 0; round < 10; round++) {
+            CHACHA_QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+            CHACHA_QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+            CHACHA_QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+            CHACHA_QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+            CHACHA_QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+            CHACHA_QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+            CHACHA_QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+            CHACHA_QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+        }
+        for(int i = 0; i < 16; i++) {
+            out[16 * b + i] = x[i] + input[i];
+        }
+    }
+}
+
+#if defined(__x86_64__)
+SIMD_TARGET_AVX2 static inline __m256i rotl32_avx2(__m256i x, int n) {
+    return _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - n));
+}
+
+// Rotations by whole bytes are byte shuffles
+SIMD_TARGET_AVX2 static inline __m256i rotl32_16_avx2(__m256i x) {
+    const __m256i shuffle = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                             2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    return _mm256_shuffle_epi8(x, shuffle);
+}
+
+SIMD_TARGET_AVX2 static inline __m256i rotl32_8_avx2(__m256i x) {
+    const __m256i shuffle = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+                                             3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+    return _mm256_shuffle_epi8(x, shuffle);
+}
+
+#define CHACHA_QUARTER_ROUND_AVX2(a, b, c, d) \
+    a = _mm256_add_epi32(a, b); d = rotl32_16_avx2(_mm256_xor_si256(d, a)); \
+    c = _mm256_add_epi32(c, d); b = rotl32_avx2(_mm256_xor_si256(b, c), 12); \
+    a = _mm256_add_epi32(a, b); d = rotl32_8_avx2(_mm256_xor_si256(d, a)); \
+    c = _mm256_add_epi32(c, d); b = rotl32_avx2(_mm256_xor_si256(b, c), 7);
+
+// Eight blocks at once, block b in lane b of every word, written out in the
+// same order as the scalar version
+SIMD_TARGET_AVX2 void chacha20_blocks8_avx2(const uint32_t* state, uint64_t counter, uint32_t* out) {
+    __m256i input[16], x[16];
+    for(int i = 0; i < 16; i++) {
+        input[i] = _mm256_set1_epi32(state[i]);
+    }
+    alignas(32) uint32_t low[8], high[8];
+    for(int b = 0; b < 8; b++) {
+        low[b] = (uint32_t)(counter + b);
+        high[b] = (uint32_t)((counter + b) >> 32);
+    }
+    input[12] = _mm256_load_si256((const __m256i*)low);
+    input[13] = _mm256_load_si256((const __m256i*)high);
+    for(int i = 0; i < 16; i++) {
+        x[i] = input[i];
+    }
+    for(int round = 0; round < 10; round++) {
+        CHACHA_QUARTER_ROUND_AVX2(x[0], x[4], x[8], x[12]);
+        CHACHA_QUARTER_ROUND_AVX2(x[1], x[5], x[9], x[13]);
+        CHACHA_QUARTER_ROUND_AVX2(x[2], x[6], x[10], x[14]);
+        CHACHA_QUARTER_ROUND_AVX2(x[3], x[7], x[11], x[15]);
+        CHACHA_QUARTER_ROUND_AVX2(x[0], x[5], x[10], x[15]);
+        CHACHA_QUARTER_ROUND_AVX2(x[1], x[6], x[11], x[12]);
+        CHACHA_QUARTER_ROUND_AVX2(x[2], x[7], x[8], x[13]);
+        CHACHA_QUARTER_ROUND_AVX2(x[3], x[4], x[9], x[14]);
+    }
+    alignas(32) uint32_t words[16][8];
+    for(int i = 0; i < 16; i++) {
+        _mm256_store_si256((__m256i*)words[i], _mm256_add_epi32(x[i], input[i]));
+    }
+    for(int b = 0; b < 8; b++) {
+        for(int i = 0; i < 16; i++) {
+            out[16 * b + i] = words[i][b];
+        }
+    }
+}
+#endif
+
+void chacha20_blocks(const uint32_t* state, uint64_t counter, uint64_t count, uint32_t* out) {
+#if defined(__x86_64__)
+    if (simd_level != SIMD_SCALAR) {
+        for(; count >= 8; count -= 8, counter += 8, out += 128) {
+            chacha20_blocks8_avx2(state, counter, out);
+        }
+    }
+#endif
+    chacha20_blocks_scalar(state, counter, count, out);
+}
+
+// Seeded generator of uniform field elements. Each 64-bit word of the
+// keystream is cut to 61 bits and the one value that is not below PR is
+// rejected, so elements are exactly uniform. The same key and stream give
+// the same elements on every machine, so parties holding a common seed can
+// derive the same values instead of sending them.
+class Prg {
+public:
+    static const uint64_t BLOCKS = 8;
+
+    Prg() {
+        uint8_t key[32] = {};
+        chacha20_init(key, 0, 0, state);
+    }
+
+    Prg(const uint8_t* key, uint64_t stream) {
+        chacha20_init(key, 0, stream, state);
+    }
+
+    uint64_t next_field() {
+        while(true) {
+            if (position == BLOCKS * 8) {
+                refill();
+            }
+            uint64_t value = buffer[position++] & PR;
+            if (value != PR) {
+                return value;
+            }
+        }
+    }
+
+    // Raw 64-bit keystream word, for seeds and keys
+    uint64_t next_u64() {
+        if (position == BLOCKS * 8) {
+            refill();
+        }
+        return buffer[position++];
+    }
+
+    // Same elements as count calls of next_field(). Once the buffer is used
+    // up, whole blocks are generated straight into out and compacted past
+    // any rejected word.
+    void fill_field(uint64_t* out, uint64_t count) {
+        uint64_t i = 0;
+        while(i < count && position < BLOCKS * 8) {
+            out[i++] = next_field();
+        }
+        while(count - i >= 8) {
+            uint64_t blocks = (count - i) / 8;
+            chacha20_blocks(state, counter, blocks, (uint32_t*)(out + i));
+            counter += blocks;
+            uint64_t end = i + 8 * blocks;
+            uint64_t j = i;
+            for(; i < end; i++) {
+                uint64_t value = out[i] & PR;
+                if (value != PR) {
+                    out[j++] = value;
+                }
+            }
+            i = j;
+        }
+        while(i < count) {
+            out[i++] = next_field();
+        }
+    }
+
+private:
+    void refill() {
+        chacha20_blocks(state, counter, BLOCKS, (uint32_t*)buffer);
+        counter += BLOCKS;
+        position = 0;
+    }
+
+    uint32_t state[16];
+    uint64_t counter = 0;
+    // Word i is bytes 8i..8i+7 of the keystream, little endian
+    alignas(32) uint64_t buffer[BLOCKS * 8];
+    uint64_t position = BLOCKS * 8;
+};
@@ -0,0 +1,48 @@
+#pragma once
+#include "arithmetic.h"
+#include "prg.h"
+#include "transcript.h"
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+const uint64_t MASK_SEED_BYTES = 16;
+
+// Two additive shares of P(X) per round. The first share is pure
+// randomness: round r's p_coeffs_ss1 is stream r of a Prg keyed by
+// mask_seed, so the verifier holding it only needs the seed.
+struct Proof {
+    vector< vector<uint64_t> > p_coeffs_ss1;
+    vector< vector<uint64_t> > p_coeffs_ss2;
+    uint8_t mask_seed[MASK_SEED_BYTES] = {};
+};
+
+// What a verifier sends the other after reading its proof share
+struct VerMsg {
+    vector<uint64_t> p_eval_ksum_ss;
+    vector<uint64_t> p_eval_r_ss;
+    uint64_t final_input;
+    uint64_t final_result_ss;
+};
+
+// Generator of round's first share; the 16-byte seed is stretched to a
+// ChaCha20 key with SHAKE128
+Prg mask_prg(const uint8_t* seed, uint64_t round) {
+    uint8_t key[32];
+    shake128(seed, MASK_SEED_BYTES, key, 32);
+    return Prg(key, round);
+}
+
+// The first shares of a proof whose rounds have the given numbers of
+// coefficients
+vector< vector<uint64_t> > expand_mask_shares(const uint8_t* seed, const vector<uint64_t>& sizes) {
+    uint8_t key[32];
+    shake128(seed, MASK_SEED_BYTES, key, 32);
+    vector< vector<uint64_t> > shares(sizes.size());
+    for(int r = 0; r < sizes.size(); r++) {
+        shares[r].resize(sizes[r]);
+        Prg(key, r).fill_field(shares[r].data(), sizes[r]);
+    }
+    return shares;
+}
@@ -1,608 +1,3633 @@
+#include "arena.h"
 #include "arithmetic.h"
+#include "lagrange.h"
+#include "net.h"
+#include "prg.h"
+#include "proof.h"
+#include "stream.h"
+#include "trace.h"
+#include "threadpool.h"
+#include "transcript.h"
+#include "wire.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
+#include <linux/perf_event.h>
+#include <memory>
+#include <sys/ioctl.h>
+#include <sys/random.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include <vector>
 
 using namespace std;
 
-clock_t begin_time, finish_time;
+// Wall-clock milliseconds; clock() would add up the CPU time of all threads
+double wall_time() {
+    return chrono::duration<double, milli>(chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-uint64_t get_rand() {
-    uint64_t left, right;
-    left = rand();
-    right = ((uint64_t)rand()) + (left<<32);
-    return right & PR;
+// Per thread, since the sessions of a batch are proven concurrently
+thread_local double begin_time, finish_time;
+
+// Timing and progress lines of the prover and verifier go to log_out(),
+// which discards them on threads that turned verbose off
+thread_local bool verbose = true;
+thread_local ostream null_out(nullptr);
+
+ostream& log_out() {
+    return verbose ? cout : null_out;
 }
 
-uint64_t generate_challenge() {
-    return get_rand();
+// get_rand() draws from a ChaCha20 stream of the key set by seed_rand().
+// Each thread takes the next stream id the first time it draws after a
+// seed_rand(), so concurrent sessions never share masks.
+uint8_t rand_key[32];
+atomic<uint64_t> rand_epoch{1}, rand_streams{0};
+
+void set_rand_key(const uint8_t* key) {
+    memcpy(rand_key, key, 32);
+    rand_streams = 0;
+    rand_epoch++;
 }
 
-struct Proof {
-    vector< vector<uint64_t> > p_coeffs_ss1;
-    vector< vector<uint64_t> > p_coeffs_ss2;
-};
+// Keys the PRG with 32 bytes from the OS. Every mask and share comes from
+// this key, so it needs the full 256 bits. Prints the reason and returns
+// false if the OS has none to give.
+bool seed_rand() {
+    uint8_t key[32];
+    if (getrandom(key, 32, 0) != 32) {
+        cout << "Could not get randomness from the OS" << endl;
+        return false;
+    }
+    set_rand_key(key);
+    return true;
+}
 
-uint64_t** get_bases(uint64_t n) {
-    uint64_t** result = new uint64_t*[n-1];
-    for (int i = 0; i < n - 1; i++) {
-        result[i] = new uint64_t[n];
-        for(int j = 0; j < n; j++) {
-            result[i][j] = 1;
-            for(int l = 0; l < n; l++) {
-                if (l != j) {
-                    uint64_t denominator, numerator;
-                    if (j > l) {
-                        denominator = j - l;
-                    }
-                    else {
-                        denominator = neg_modp(l - j);
-                    }
-                    numerator = i + n - l;
-                    result[i][j] = mul_modp(result[i][j], mul_modp(inverse(denominator), numerator));
-                }
-            }
-        }
+// Deterministic key from a 64-bit seed, for tests that must repeat a run
+void seed_rand(uint64_t seed) {
+    uint8_t bytes[8];
+    uint8_t key[32];
+    for(int i = 0; i < 8; i++) {
+        bytes[i] = seed >> (8 * i);
     }
-    return result;
+    shake128(bytes, 8, key, 32);
+    set_rand_key(key);
 }
 
-uint64_t* evaluate_bases(uint64_t n, uint64_t r) {
-    uint64_t* result = new uint64_t[n];
-    for(int i = 0; i < n; i++) {
-        result[i] = 1;
-        for(int j = 0; j < n; j++) {
-            if (j != i) {
-                uint64_t denominator, numerator; 
-                if (i > j) { 
-                    denominator = i - j;
-                } 
-                else { 
-                    denominator = neg_modp(j - i);
-                }
-                if (r > j) { 
-                    numerator = r - j; 
-                } 
-                else { 
-                    numerator = neg_modp(j - r);
-                }
-                result[i] = mul_modp(result[i], mul_modp(inverse(denominator), numerator));
-            }
-        }
+Prg& thread_prg() {
+    thread_local Prg prg;
+    thread_local uint64_t epoch = 0;
+    if (epoch != rand_epoch) {
+        prg = Prg(rand_key, rand_streams++);
+        epoch = rand_epoch;
     }
-    return result;
+    return prg;
+}
+
+uint64_t get_rand() {
+    return thread_prg().next_field();
+}
+
+uint64_t generate_challenge() {
+    return get_rand();
 }
 
-bool test_evaluate_bases() {
+bool test_lagrange_table() {
     uint64_t k = 10;
+    LagrangeTable lagrange(k);
+    vector<uint64_t> eval_base(k);
     for(int i = 0; i < k; i++) {
-        uint64_t* eval_base = evaluate_bases(k, i);
-        if(eval_base[i] != 1) {
-            cout << "evaluate_bases() incorrect" << endl;
-            return false;
-        }
+        lagrange.evaluate(i, eval_base.data());
         for(int j = 0; j < k; j++) {
-            if(j != i) {
-                if(eval_base[j] != 0) {
-                    cout << "evaluate_bases() incorrect" << endl;
-                    return false;
-                }
+            if(eval_base[j] != (i == j ? 1 : 0)) {
+                cout << "LagrangeTable incorrect" << endl;
+                return false;
             }
         }
     }
-    cout << "evaluate_bases() correct" << endl;
+    // Interpolate f(x) = c_0 + c_1 x + ... + c_{k-1} x^{k-1} from f(0..k-1)
+    vector<uint64_t> coeffs(k), values(k);
+    for(int i = 0; i < k; i++) {
+        coeffs[i] = get_rand() % PR;
+    }
+    auto f = [&](uint64_t x) {
+        uint64_t res = 0;
+        for(int i = k - 1; i >= 0; i--) {
+            res = add_modp(mul_modp(res, x), coeffs[i]);
+        }
+        return res;
+    };
+    for(int i = 0; i < k; i++) {
+        values[i] = f(i);
+    }
+    for(int i = 0; i < k - 1; i++) {
+        if(inner_productp_scalar((uint64_t*)lagrange.extension_bases()[i].data(), values.data(), k) != f(k + i)) {
+            cout << "LagrangeTable incorrect" << endl;
+            return false;
+        }
+    }
+    uint64_t r = get_rand() % PR;
+    lagrange.evaluate(r, eval_base.data());
+    if(inner_productp_scalar(eval_base.data(), values.data(), k) != f(r)) {
+        cout << "LagrangeTable incorrect" << endl;
+        return false;
+    }
+    cout << "LagrangeTable correct" << endl;
     return true;
 }
 
+// How fliop() gets P(k..2k-2) from the round's rows. INTERP_GRAM takes all k^2
+// inner products <input_left[i], input_right[j]> (k multiplications per entry)
+// and combines them with the extension bases. INTERP_EXTEND extends every
+// column of the rows to the points k..2k-2 with a Karatsuba Toeplitz product
+// (O(k^0.58) multiplications per entry) and multiplies the extended columns,
+// so large k no longer makes the prover k times slower.
+enum InterpolationEngine {
+    INTERP_AUTO = 0,
+    INTERP_GRAM = 1,
+    INTERP_EXTEND = 2
+};
 
-Proof fliop(uint64_t** input_left, uint64_t** input_right, uint64_t var, uint64_t copy, uint64_t k, uint64_t sid, uint64_t* rands) {
-    uint64_t L = var;
-    uint64_t T = copy;
-    uint64_t s = T / k;
-    // uint64_t eta = generate_challenge();
-    uint64_t eta = rands[0];
-
-    //Prepare Input
-    begin_time = clock();
-    uint64_t eta_power = 1;
-    for(int i = 0; i < k; i++) {
-        for(int j = 0; j < s; j++) {
-            input_left[i][2 * j] = mul_modp(input_left[i][2 * j], eta_power);
-            input_left[i][2 * j + 1] = mul_modp(input_left[i][2 * j + 1], eta_power);
-            eta_power = mul_modp(eta_power, eta);
-        }
+InterpolationEngine choose_engine(uint64_t k, InterpolationEngine engine) {
+    if (engine != INTERP_AUTO) {
+        return engine;
     }
-    finish_time = clock();
-    cout<<"Prepare Input Time = "<<double(finish_time-begin_time)/CLOCKS_PER_SEC * 1000<<"ms"<<endl;
+    // Measured crossover of the two engines with AVX-512 inner products
+    return k >= 256 ? INTERP_EXTEND : INTERP_GRAM;
+}
 
-    s *= 2;
-    vector< vector<uint64_t> > p_coeffs_ss1;
-    vector< vector<uint64_t> > p_coeffs_ss2;
-    uint64_t** base = get_bases(k);
-    uint64_t* eval_base;
-    uint64_t s0;
-    uint64_t** eval_result = new uint64_t*[k];
-    for(int i = 0; i < k; i++) {
-        eval_result[i] = new uint64_t[k];
-    }
-    uint64_t* eval_p_poly = new uint64_t[2 * k - 1];
-    uint64_t r;
-    uint128_t temp_result;
-    uint64_t index;
+const char* engine_name(InterpolationEngine engine) {
+    return engine == INTERP_EXTEND ? "extend" : "gram";
+}
 
-    uint16_t cnt = 1;
+// Number of sums a slice of the rows contributes to P(0..2k-2)
+uint64_t p_sums_size(uint64_t k, InterpolationEngine engine) {
+    return engine == INTERP_GRAM ? k * k : 2 * k - 1;
+}
 
-    while(true){
-        cout<<"s : "<<s<<endl;
-        cout<<"k : "<<k<<endl;
+uint64_t p_sums_scratch_size(const LagrangeTable& lagrange) {
+    return 4 * lagrange.size() + lagrange.extension_scratch_size();
+}
 
-        //Compute P(X)
-        begin_time = clock();
+// Sums over positions [offset, offset + len) of the rows: for INTERP_GRAM
+// sums[i * k + j] = <left[i], right[j]>; for INTERP_EXTEND sums[i] =
+// <left[i], right[i]> and sums[k + i] the inner product of the columns'
+// scaled extensions at k + i. scratch needs p_sums_scratch_size() entries.
+void slice_p_sums(uint64_t** left, uint64_t** right, uint64_t k, uint64_t offset, uint64_t len, InterpolationEngine engine, const LagrangeTable& lagrange, uint64_t* scratch, uint64_t* sums) {
+    if (engine == INTERP_GRAM) {
+        inner_product_matrixp(left, right, k, offset, len, sums);
+        return;
+    }
+    uint64_t* column_left = scratch;
+    uint64_t* column_right = scratch + k;
+    uint64_t* ext_left = scratch + 2 * k;
+    uint64_t* ext_right = scratch + 3 * k;
+    uint64_t* ext_scratch = scratch + 4 * k;
+    for(int i = 0; i < 2 * k - 1; i++) {
+        sums[i] = 0;
+    }
+    for(uint64_t t = offset; t < offset + len; t++) {
         for(int i = 0; i < k; i++) {
-            for(int j = 0; j < k; j++) {
-                eval_result[i][j] = inner_productp(input_left[i], input_right[j], s);
-            }
+            column_left[i] = left[i][t];
+            column_right[i] = right[i][t];
+            sums[i] = add_modp(sums[i], mul_modp(column_left[i], column_right[i]));
         }
+        lagrange.extend_scaled(column_left, ext_left, ext_scratch);
+        lagrange.extend_scaled(column_right, ext_right, ext_scratch);
+        for(int i = 0; i < k - 1; i++) {
+            sums[k + i] = add_modp(sums[k + i], mul_modp(ext_left[i], ext_right[i]));
+        }
+    }
+}
 
+// P(0..2k-2) from the sums of a whole round
+void interpolate_p(uint64_t* sums, uint64_t k, InterpolationEngine engine, const LagrangeTable& lagrange, uint64_t* eval_p_poly, Arena& arena) {
+    if (engine == INTERP_EXTEND) {
+        const vector<uint64_t>& scale = lagrange.extension_scale();
         for(int i = 0; i < k; i++) {
-            eval_p_poly[i] = eval_result[i][i];
+            eval_p_poly[i] = sums[i];
         }
         for(int i = 0; i < k - 1; i++) {
-            eval_p_poly[i + k] = 0;
-            for(int j = 0; j < k; j++) {
-                for (int l = 0; l < k; l++) {
-                    eval_p_poly[i+k] = add_modp(eval_p_poly[i+k], mul_modp(base[i][j], mul_modp(eval_result[j][l], base[i][l])));
-                }
-            }
+            eval_p_poly[i + k] = mul_modp(sums[i + k], mul_modp(scale[i], scale[i]));
         }
-        finish_time = clock();
-        cout<<"Interpolation Time = "<<double(finish_time-begin_time)/CLOCKS_PER_SEC * 1000<<"ms"<<endl;
-
-        //generate proof
-        begin_time = clock();
-        vector<uint64_t> ss1(2 * k - 1), ss2(2 * k - 1);
-        uint64_t temp;
-        for(int i = 0; i < 2 * k - 1; i++) {
-            ss1[i] = get_rand();
-            if(eval_p_poly[i] > ss1[i]) {
-                temp = eval_p_poly[i] - ss1[i];
-            }
-            else {
-                temp = PR - ss1[i] + eval_p_poly[i];
-            }
-            ss2[i] = temp;
+        return;
+    }
+    // P(k + i) = base[i]^T * E * base[i] for the k x k matrix E of inner products
+    const vector< vector<uint64_t> >& base = lagrange.extension_bases();
+    ArenaScope scope(arena);
+    uint64_t* row = arena.alloc<uint64_t>(k);
+    for(int i = 0; i < k; i++) {
+        eval_p_poly[i] = sums[i * k + i];
+    }
+    for(int i = 0; i < k - 1; i++) {
+        uint64_t* base_i = (uint64_t*) base[i].data();
+        for(int j = 0; j < k; j++) {
+            row[j] = inner_productp_scalar(&sums[j * k], base_i, k);
         }
-        p_coeffs_ss1.push_back(ss1);
-        p_coeffs_ss2.push_back(ss2);
-        finish_time = clock();
-        cout<<"Generate Proof Time = "<<double(finish_time-begin_time)/CLOCKS_PER_SEC * 1000<<"ms"<<endl;
+        eval_p_poly[i + k] = inner_productp_scalar(base_i, row, k);
+    }
+}
 
-        if (s == 1) {
-            break;
-        }
+// Compression factor of round r under the schedule ks. The last entry of ks
+// is used for every round past the end of the schedule.
+uint64_t round_k(const vector<uint64_t>& ks, uint64_t r) {
+    return ks[r < ks.size() ? r : ks.size() - 1];
+}
 
-        // Prepare Next Input
-        begin_time = clock();
-        r = rands[cnt];
-        eval_base = evaluate_bases(k, r);
+string schedule_name(const vector<uint64_t>& ks) {
+    string name;
+    for(int i = 0; i < ks.size(); i++) {
+        name += (i == 0 ? "" : ",") + to_string(ks[i]);
+    }
+    return name;
+}
 
-        s0 = s;
-        s = (s - 1) / k + 1;
-        for(int i = 0; i < k; i++) {
-            for(int j = 0; j < s; j++) {
-                index = i * s + j;
-                if (index < s0) {
-                    temp_result = 0;
-                    for(int l = 0; l < k; l++) {
-                        temp_result += ((uint128_t) eval_base[l]) * ((uint128_t) input_left[l][index]);
-                    }
-                    input_left[i][j] = modp_128(temp_result);
+// Row length of every round when the 2 * copy input entries are split by the
+// schedule ks; the proof has one round per entry
+vector<uint64_t> round_lengths(uint64_t copy, const vector<uint64_t>& ks) {
+    vector<uint64_t> lengths(1, 2 * ((copy - 1) / ks[0] + 1));
+    while(lengths.back() > 1) {
+        lengths.push_back((lengths.back() - 1) / round_k(ks, lengths.size()) + 1);
+    }
+    return lengths;
+}
 
-                    temp_result = 0;
-                    for(int l = 0; l < k; l++) {
-                        temp_result += ((uint128_t) eval_base[l]) * ((uint128_t) input_right[l][index]);
-                    }
-                    input_right[i][j] = modp_128(temp_result);
-                }
-                else {
-                    input_left[i][j] = 0;
-                    input_right[i][j] = 0;
+// Largest compression factor of rounds first.. of the schedule
+uint64_t max_round_k(const vector<uint64_t>& ks, const vector<uint64_t>& lengths, uint64_t first) {
+    uint64_t k_max = 0;
+    for(uint64_t r = first; r < lengths.size(); r++) {
+        k_max = max(k_max, round_k(ks, r));
+    }
+    return k_max;
+}
+
+// Row pointers for rounds first.. of the schedule: the first round_k(ks,
+// first) are the caller's rows, and later rounds that split into more rows
+// than that keep the extra rows in the arena
+uint64_t** schedule_rows(uint64_t** rows, const vector<uint64_t>& ks, const vector<uint64_t>& lengths, uint64_t first, Arena& arena) {
+    uint64_t k = round_k(ks, first);
+    uint64_t k_max = max_round_k(ks, lengths, first), capacity = 0;
+    for(uint64_t r = first + 1; r < lengths.size(); r++) {
+        if (round_k(ks, r) > k) {
+            capacity = max(capacity, lengths[r]);
+        }
+    }
+    uint64_t** result = arena.alloc<uint64_t*>(k_max);
+    uint64_t* storage = arena.alloc<uint64_t>((k_max - k) * capacity);
+    for(uint64_t i = 0; i < k_max; i++) {
+        result[i] = i < k ? rows[i] : &storage[(i - k) * capacity];
+    }
+    return result;
+}
+
+// Computes the round's sums over the first s entries of the rows. Each thread
+// takes a contiguous slice of [0, s) and produces the sums for it in a single
+// pass over its slice; the partials are then added in chunk order, so the
+// result does not depend on the number of threads.
+void compute_p_sums(uint64_t** input_left, uint64_t** input_right, uint64_t k, uint64_t s, InterpolationEngine engine, const LagrangeTable& lagrange, uint64_t* sums, Arena& arena, ThreadPool* pool) {
+    uint64_t size = p_sums_size(k, engine);
+    uint64_t scratch_size = p_sums_scratch_size(lagrange);
+    uint64_t chunks = num_chunks_of(pool);
+    if (s < chunks * 1024) {
+        chunks = 1;
+    }
+    ArenaScope scope(arena);
+    uint64_t* partial = arena.alloc<uint64_t>(chunks * size);
+    uint64_t* scratch = arena.alloc<uint64_t>(chunks * scratch_size);
+    parallel_for(pool, s, chunks, [&](uint64_t c, uint64_t start, uint64_t end) {
+        slice_p_sums(input_left, input_right, k, start, end - start, engine, lagrange, &scratch[c * scratch_size], &partial[c * size]);
+    });
+    for(int i = 0; i < size; i++) {
+        uint128_t sum = 0;
+        for(int c = 0; c < chunks; c++) {
+            sum += partial[c * size + i];
+        }
+        sums[i] = modp_128(sum);
+    }
+}
+
+// Folds the k rows of length s0 in input_left and input_right with eval_base
+// into k_next rows of length s (entries past s0 become 0), and computes the
+// next round's sums in the same pass with that round's engine and table.
+// Positions are processed in small blocks: the block is folded into a scratch
+// tile, its sums are taken from the tile while it is in cache, and the tile is
+// then written back. Position t of a row is only read when folding position t
+// itself, so writing the tile back in place is safe and threads never touch
+// each other's blocks.
+void fold_and_sum(uint64_t** input_left, uint64_t** input_right, uint64_t* eval_base, uint64_t k, uint64_t s0, uint64_t k_next, uint64_t s, InterpolationEngine engine, const LagrangeTable& lagrange, uint64_t* sums, Arena& arena, ThreadPool* pool) {
+    const uint64_t block = 256;
+    uint64_t size = p_sums_size(k_next, engine);
+    uint64_t scratch_size = p_sums_scratch_size(lagrange);
+    uint64_t chunks = num_chunks_of(pool);
+    if (s < chunks * 1024) {
+        chunks = 1;
+    }
+    ArenaScope scope(arena);
+    uint64_t* partial = arena.alloc<uint64_t>(chunks * size);
+    uint64_t* tiles = arena.alloc<uint64_t>(chunks * 2 * k_next * block);
+    uint64_t** tile_rows = arena.alloc<uint64_t*>(chunks * 2 * k_next);
+    uint64_t* all_products = arena.alloc<uint64_t>(chunks * size);
+    uint64_t* all_scratch = arena.alloc<uint64_t>(chunks * scratch_size);
+    uint128_t* all_acc = arena.alloc_zero<uint128_t>(chunks * size);
+    parallel_for(pool, s, chunks, [&](uint64_t c, uint64_t start, uint64_t end) {
+        uint64_t* tile = &tiles[c * 2 * k_next * block];
+        uint64_t** tile_left = &tile_rows[c * 2 * k_next];
+        uint64_t** tile_right = tile_left + k_next;
+        uint64_t* products = &all_products[c * size];
+        uint64_t* scratch = &all_scratch[c * scratch_size];
+        uint128_t* acc = &all_acc[c * size];
+        for(int i = 0; i < k_next; i++) {
+            tile_left[i] = &tile[i * block];
+            tile_right[i] = &tile[(k_next + i) * block];
+        }
+        for(uint64_t t = start; t < end; t += block) {
+            uint64_t len = t + block < end ? block : end - t;
+            for(int i = 0; i < k_next; i++) {
+                uint64_t index = i * s + t;
+                uint64_t valid = index >= s0 ? 0 : (s0 - index < len ? s0 - index : len);
+                fold_modp(input_left, eval_base, k, index, valid, tile_left[i]);
+                fold_modp(input_right, eval_base, k, index, valid, tile_right[i]);
+                for(int j = valid; j < len; j++) {
+                    tile_left[i][j] = 0;
+                    tile_right[i][j] = 0;
                 }
             }
+            slice_p_sums(tile_left, tile_right, k_next, 0, len, engine, lagrange, scratch, products);
+            for(int i = 0; i < size; i++) {
+                acc[i] += products[i];
+            }
+            for(int i = 0; i < k_next; i++) {
+                memcpy(input_left[i] + t, tile_left[i], len * sizeof(uint64_t));
+                memcpy(input_right[i] + t, tile_right[i], len * sizeof(uint64_t));
+            }
         }
-        finish_time = clock();
-        cout<<"Prepare Input Time = "<<double(finish_time-begin_time)/CLOCKS_PER_SEC * 1000<<"ms"<<endl;
-
-        cnt++;
+        for(int i = 0; i < size; i++) {
+            partial[c * size + i] = modp_128(acc[i]);
+        }
+    });
+    for(int i = 0; i < size; i++) {
+        uint128_t sum = 0;
+        for(int c = 0; c < chunks; c++) {
+            sum += partial[c * size + i];
+        }
+        sums[i] = modp_128(sum);
     }
+}
 
-    Proof result = {p_coeffs_ss1, p_coeffs_ss2};
-    return result;
+const uint64_t COIN_BYTES = 16;
+
+// Coin of one proof that the verifiers (parties 0 and 2) toss once the AND
+// gates are evaluated and the triples fixed: the XOR of one random
+// contribution from each, sent to the other two parties
+struct VerifierCoin {
+    uint8_t bytes[COIN_BYTES] = {};
+};
+
+// One party's contribution to a coin, or the whole coin when a single
+// process plays every party
+VerifierCoin draw_coin() {
+    VerifierCoin coin;
+    for(int i = 0; i < COIN_BYTES; i += 8) {
+        uint64_t word = thread_prg().next_u64();
+        memcpy(coin.bytes + i, &word, 8);
+    }
+    return coin;
 }
 
-Proof prove_and_gate(uint64_t _party_id, uint64_t** input_left, uint64_t** input_right, uint64_t var, uint64_t copy, uint64_t k, uint64_t sid, uint64_t* rands) {
-    return fliop(input_left, input_right, var, copy, k, sid, rands);
+// Transcript of one proof, bound to the session, the shape of its rounds and
+// the verifiers' coin. The session and the shape are known before the
+// triples are, so eta drawn from them alone would let whoever produces the
+// triples plant errors that cancel in the eta-weighted sum; the coin is only
+// known once the triples are fixed.
+Transcript proof_transcript(uint64_t sid, uint64_t copy, const vector<uint64_t>& ks, const VerifierCoin& coin, const char* label = "dzkp-and-gates") {
+    vector<uint64_t> lengths = round_lengths(copy, ks);
+    Transcript transcript(label);
+    transcript.append_u64("sid", sid);
+    transcript.append_field("schedule", ks.data(), ks.size());
+    transcript.append_field("lengths", lengths.data(), lengths.size());
+    transcript.append_message("coin", coin.bytes, COIN_BYTES);
+    return transcript;
 }
 
-struct VerMsg {
-    vector<uint64_t> p_eval_ksum_ss;
-    vector<uint64_t> p_eval_r_ss;
-    uint64_t final_input;
-    uint64_t final_result_ss;
-};
+// Labels of the two transcripts of a split proof and of the shares they take
+const char* SHARE_TRANSCRIPTS[2] = {"dzkp-and-gates-ss1", "dzkp-and-gates-ss2"};
+const char* SHARE_LABELS[2] = {"p_ss1", "p_ss2"};
 
-VerMsg gen_vermsg(
-    vector< vector<uint64_t> > p_eval_ss, 
-    uint64_t** input,
-    uint64_t** input_mono, 
-    uint64_t var, 
-    uint64_t copy, 
-    uint64_t k, 
-    uint64_t sid, 
-    uint64_t* rands,
-    uint64_t prover_ID,
-    uint64_t party_ID
-) {
-    uint64_t L = var;
-    uint64_t T = copy;
-    uint64_t s = T / k;
+// Appends share (0 or 1) of a round's P(X) to its transcript and draws that
+// transcript's part of the round's challenge
+uint64_t share_challenge(Transcript& transcript, uint64_t share, const vector<uint64_t>& coeffs) {
+    transcript.append_field(SHARE_LABELS[share], coeffs.data(), coeffs.size());
+    return transcript.challenge_field("r");
+}
 
-    uint64_t eta = rands[0];
+// The prover's side of Fiat-Shamir. With one transcript both shares of every
+// round are appended to it. Split, as dzkp/ does it, share i of every round
+// only goes to transcript i and every challenge is the sum of one challenge
+// from each, so the verifier holding share i can draw its half alone and the
+// two verifiers only swap halves. on_round, if set, sees the proof as soon as
+// each round's shares exist, before the round's challenge is drawn.
+class ProverTranscript {
+public:
+    explicit ProverTranscript(Transcript transcript) : transcripts(1, transcript) {}
 
-    uint64_t* eval_base;
-    uint64_t r, s0, index, cnt = 1;
-    uint128_t temp_result;
+    ProverTranscript(Transcript first, Transcript second) : transcripts({first, second}) {}
 
-    uint64_t len = log(2 * T) / log(k) + 2;
+    // A split transcript of one proof, see split_challenges()
+    static ProverTranscript split(uint64_t sid, uint64_t copy, const vector<uint64_t>& ks, const VerifierCoin& coin) {
+        return ProverTranscript(proof_transcript(sid, copy, ks, coin, SHARE_TRANSCRIPTS[0]), proof_transcript(sid, copy, ks, coin, SHARE_TRANSCRIPTS[1]));
+    }
 
-    vector<uint64_t> p_eval_ksum_ss(len);
-    vector<uint64_t> p_eval_r_ss(len);
-    uint64_t final_input;
-    uint64_t final_result_ss;
+    uint64_t eta() {
+        uint64_t eta = 0;
+        for(int i = 0; i < transcripts.size(); i++) {
+            eta = add_modp(eta, transcripts[i].challenge_field("eta"));
+        }
+        return eta;
+    }
 
-    if(false) {
-        // Compute ETA
-        begin_time = clock();
-        uint64_t** eta_power = new uint64_t*[k];
-        for(int i = 0; i < k; i++) {
-            eta_power [i] = new uint64_t[s];
-            if (i == 0) {
-                eta_power[i][0] = 1;
-            }
-            else {
-                eta_power[i][0] = mul_modp(eta_power[i - 1][s - 1], eta); 
-            }
-            for(int j = 1; j < s; j ++) {
-                eta_power[i][j] = mul_modp(eta_power[i][j - 1], eta);
-            }
+    // Challenge that folds the proof's last round
+    uint64_t round(const Proof& proof) {
+        if (on_round) {
+            on_round(proof);
         }
-        finish_time = clock();
-        cout<<"Compute ETA Time = "<<double(finish_time-begin_time)/CLOCKS_PER_SEC * 1000<<"ms"<<endl;
-        
-        // Prepare Input
-        if ((party_ID + 1 - prover_ID) % 3 == 0) {
-            begin_time = clock();
-            for(int i = 0; i < k; i++) {
-                for(int j = 0; j < s; j++) {
-                    input[i][2 * j] = mul_modp(input[i][2 * j], eta_power[i][j]);
-                    input[i][2 * j + 1] = mul_modp(input[i][2 * j + 1], eta_power[i][j]);
-                }
-            }
-            finish_time = clock();
-            cout<<"Prepare Input Time = "<<double(finish_time-begin_time)/CLOCKS_PER_SEC * 1000<<"ms"<<endl;
+        if (transcripts.size() == 1) {
+            transcripts[0].append_field(SHARE_LABELS[0], proof.p_coeffs_ss1.back().data(), proof.p_coeffs_ss1.back().size());
+            return share_challenge(transcripts[0], 1, proof.p_coeffs_ss2.back());
         }
+        return add_modp(share_challenge(transcripts[0], 0, proof.p_coeffs_ss1.back()), share_challenge(transcripts[1], 1, proof.p_coeffs_ss2.back()));
+    }
 
-        begin_time = clock();
-        p_eval_r_ss[0] = 0;
-        for(int i = 0; i < k; i++) {
-            p_eval_r_ss[0] += inner_productp(eta_power[i], input_mono[i], s);
-        }
-        p_eval_r_ss[0] = modp(p_eval_r_ss[0]);
-        finish_time = clock();
-        cout<<"Compute Monomial Time = "<<double(finish_time-begin_time)/CLOCKS_PER_SEC * 1000<<"ms"<<endl;
+    function<void(const Proof&)> on_round;
+
+private:
+    vector<Transcript> transcripts;
+};
+
+// Draws rands[cnt], the challenge that folds the proof's last round. Without
+// a transcript rands is left as it is.
+void draw_round_challenge(ProverTranscript* transcript, const Proof& proof, uint64_t cnt, uint64_t* rands) {
+    if (transcript == nullptr) {
+        return;
     }
-    else {
-        begin_time = clock();
-        if ((party_ID + 1 - prover_ID) % 3 == 0) {
-            temp_result = 0;
-            uint64_t eta_temp = 1;
-            for(int i = 0; i < k; i++) {
-                for(int j = 0; j < s; j++) {
-                    input[i][2 * j] = mul_modp(input[i][2 * j], eta_temp);
-                    input[i][2 * j + 1] = mul_modp(input[i][2 * j + 1], eta_temp);
-                    temp_result += mul_modp(input_mono[i][j], eta_temp);
-                    eta_temp = mul_modp(eta_temp, eta);
-                }
-            }
-            p_eval_r_ss[0] = modp_128(temp_result);
+    double start = wall_time();
+    rands[cnt] = transcript->round(proof);
+    log_out()<<"Fiat-Shamir Time = "<<wall_time()-start<<"ms"<<endl;
+}
+
+// Replays the prover's transcript over a whole proof, filling rands[0] (eta)
+// and rands[1..] as the prover drew them; the verifiers then need no
+// challenges from anyone
+void fiat_shamir_challenges(Transcript transcript, const Proof& proof, uint64_t* rands) {
+    rands[0] = transcript.challenge_field("eta");
+    for(int i = 0; i < proof.p_coeffs_ss1.size(); i++) {
+        transcript.append_field("p_ss1", proof.p_coeffs_ss1[i].data(), proof.p_coeffs_ss1[i].size());
+        transcript.append_field("p_ss2", proof.p_coeffs_ss2[i].data(), proof.p_coeffs_ss2[i].size());
+        rands[i + 1] = transcript.challenge_field("r");
+    }
+}
+
+// One verifier's halves of the challenges of a split proof: halves[0] of
+// eta, halves[i + 1] of round i's challenge, from share (0 or 1) alone. The
+// challenges are the sums of both verifiers' halves.
+void split_challenges(uint64_t sid, uint64_t copy, const vector<uint64_t>& ks, const VerifierCoin& coin, uint64_t share, const vector< vector<uint64_t> >& shares, uint64_t* halves) {
+    Transcript transcript = proof_transcript(sid, copy, ks, coin, SHARE_TRANSCRIPTS[share]);
+    halves[0] = transcript.challenge_field("eta");
+    for(int i = 0; i < shares.size(); i++) {
+        halves[i + 1] = share_challenge(transcript, share, shares[i]);
+    }
+}
+
+// weights[2j] = weights[2j + 1] = first * eta^j for j < len, the eta weights
+// of len triples laid out in pairs as shape() lays out the rows; powers is
+// scratch for len entries. Returns first * eta^len, where the next block
+// starts.
+uint64_t pair_powers(uint64_t first, uint64_t eta, uint64_t len, uint64_t* powers, uint64_t* weights) {
+    powers_modp(first, eta, len, powers);
+    for(int j = 0; j < len; j++) {
+        weights[2 * j] = powers[j];
+        weights[2 * j + 1] = powers[j];
+    }
+    return len == 0 ? first : mul_modp(powers[len - 1], eta);
+}
+
+// Interpolates P(X) from a round's sums and appends its two shares to proof
+void prove_round(uint64_t* sums, uint64_t k, InterpolationEngine engine, const LagrangeTable& lagrange, Proof& proof, Arena& arena) {
+    //Compute P(X)
+    begin_time = wall_time();
+    ArenaScope scope(arena);
+    uint64_t* eval_p_poly = arena.alloc<uint64_t>(2 * k - 1);
+    interpolate_p(sums, k, engine, lagrange, eval_p_poly, arena);
+    finish_time = wall_time();
+    log_out()<<"Interpolation Time = "<<finish_time-begin_time<<"ms"<<endl;
+
+    //generate proof
+    begin_time = wall_time();
+    vector<uint64_t> ss1(2 * k - 1), ss2(2 * k - 1);
+    uint64_t temp;
+    mask_prg(proof.mask_seed, proof.p_coeffs_ss1.size()).fill_field(ss1.data(), 2 * k - 1);
+    for(int i = 0; i < 2 * k - 1; i++) {
+        if(eval_p_poly[i] > ss1[i]) {
+            temp = eval_p_poly[i] - ss1[i];
         }
         else {
-            temp_result = 0;
-            uint64_t eta_temp = 1;
-            for(int i = 0; i < k; i++) {
-                for(int j = 0; j < s; j++) {
-                    temp_result += mul_modp(input_mono[i][j], eta_temp);
-                    eta_temp = mul_modp(eta_temp, eta);
-                }
-            }
-            p_eval_r_ss[0] = modp_128(temp_result);
+            temp = PR - ss1[i] + eval_p_poly[i];
         }
-        finish_time = clock();
-        cout<<"Prepare Input + Compute Monomial Time = "<<double(finish_time-begin_time)/CLOCKS_PER_SEC * 1000<<"ms"<<endl;
+        ss2[i] = temp;
     }
+    proof.p_coeffs_ss1.push_back(ss1);
+    proof.p_coeffs_ss2.push_back(ss2);
+    finish_time = wall_time();
+    log_out()<<"Generate Proof Time = "<<finish_time-begin_time<<"ms"<<endl;
+}
 
-    s *= 2;
-    while(true)
-    {
-        cout<<"s : "<<s<<endl;
-        cout<<"k : "<<k<<endl;
+// Proves rounds first.. of the schedule. The rows hold the eta-weighted input
+// of round first and have room for the rows of every later round (see
+// schedule_rows()); they are folded in place.
+void fliop_rounds(uint64_t** rows_left, uint64_t** rows_right, const vector<uint64_t>& ks, const vector<uint64_t>& lengths, uint64_t first, uint64_t* rands, ProverTranscript* transcript, LagrangeCache& tables, Arena& arena, ThreadPool* pool, InterpolationEngine engine, Proof& proof) {
+    uint64_t k = round_k(ks, first);
+    uint64_t s = lengths[first];
+    const LagrangeTable* lagrange = &tables.get(k);
+    InterpolationEngine round_engine = choose_engine(k, engine);
+    uint64_t k_max = max_round_k(ks, lengths, first);
+    ArenaScope scope(arena);
+    uint64_t* eval_base = arena.alloc<uint64_t>(k_max);
+    uint64_t* sums = arena.alloc<uint64_t>(p_sums_size(k_max, INTERP_GRAM));
+    uint64_t s0, k_next;
+    uint64_t r;
 
-        // Compute share of sum of p's evaluations over [0, k - 1]
-        uint64_t res = 0;
-        for(int j = 0; j < k; j++) { // Assume k < 8
-            res += p_eval_ss[cnt - 1][j];
-        }
-        p_eval_ksum_ss[cnt - 1] = modp(res);
+    uint64_t cnt = first + 1;
 
-        if(s == 1) {
-            r = rands[cnt];
-            eval_base = evaluate_bases(k, r);
-            temp_result = 0;
-            for(int i = 0; i < k; i++) {
-                temp_result += ((uint128_t) eval_base[i]) * ((uint128_t) input[i][0]);
-            }
-            final_input = modp_128(temp_result);
-            eval_base = evaluate_bases(2 * k - 1, r);
-            temp_result = 0;
-            for(int i = 0; i < 2 * k - 1; i++) {
-                temp_result += ((uint128_t) eval_base[i]) * ((uint128_t) p_eval_ss[cnt - 1][i]);
-            }
-            final_result_ss = modp_128(temp_result);
+    // Later rounds get their sums from the fused fold below
+    begin_time = wall_time();
+    compute_p_sums(rows_left, rows_right, k, s, round_engine, *lagrange, sums, arena, pool);
+    finish_time = wall_time();
+    log_out()<<"Inner Product Time = "<<finish_time-begin_time<<"ms"<<endl;
+
+    while(true){
+        log_out()<<"s : "<<s<<endl;
+        log_out()<<"k : "<<k<<endl;
+
+        prove_round(sums, k, round_engine, *lagrange, proof, arena);
+        draw_round_challenge(transcript, proof, cnt, rands);
+
+        if (s == 1) {
             break;
         }
 
-        // Compute share of p's evaluation at r
+        // Prepare Next Input
+        begin_time = wall_time();
         r = rands[cnt];
-        eval_base = evaluate_bases(2 * k - 1, r);
-        temp_result = 0;
-        for(int i = 0; i < 2 * k - 1; i++) {
-            temp_result += ((uint128_t) eval_base[i]) * ((uint128_t) p_eval_ss[cnt - 1][i]);
-        }
-        p_eval_r_ss[cnt] = modp_128(temp_result);
+        lagrange->evaluate(r, eval_base);
 
-        // Compute New Input
-        begin_time = clock();
-        eval_base = evaluate_bases(k, r);
         s0 = s;
-        s = (s - 1) / k + 1;
-        for(int i = 0; i < k; i++) {
-            for(int j = 0; j < s; j++) {
-                index = i * s + j;
-                if (index < s0) {
-                    temp_result = 0;
-                    for(int l = 0; l < k; l++) {
-                        temp_result += ((uint128_t) eval_base[l]) * ((uint128_t) input[l][index]);
-                    }
-                    input[i][j] = modp_128(temp_result);
-                }
-                else {
-                    input[i][j] = 0;
-                }
-            }
-        }
-        finish_time = clock();
-        cout<<"Prepare Input Time = "<<double(finish_time-begin_time)/CLOCKS_PER_SEC * 1000<<"ms"<<endl;
+        s = lengths[cnt];
+        k_next = round_k(ks, cnt);
+        lagrange = &tables.get(k_next);
+        round_engine = choose_engine(k_next, engine);
+        fold_and_sum(rows_left, rows_right, eval_base, k, s0, k_next, s, round_engine, *lagrange, sums, arena, pool);
+        k = k_next;
+        finish_time = wall_time();
+        log_out()<<"Prepare Input + Inner Product Time = "<<finish_time-begin_time<<"ms"<<endl;
 
         cnt++;
     }
+}
 
-    VerMsg vermsg = {
-        p_eval_ksum_ss,
-        p_eval_r_ss,
-        final_input,
-        final_result_ss
-    };
-    cout << "exiting gen_vermsg()" << endl;
-    return vermsg;
+// The first shares of every round are expanded from a fresh seed
+void draw_mask_seed(Proof& proof) {
+    for(int i = 0; i < MASK_SEED_BYTES; i += 8) {
+        uint64_t word = thread_prg().next_u64();
+        memcpy(proof.mask_seed + i, &word, 8);
+    }
 }
 
-bool verify_and_gates(
-    vector< vector<uint64_t> > p_eval_ss, 
-    uint64_t** input,
-    uint64_t** input_mono, 
-    VerMsg other_vermsg, 
-    uint64_t var, 
-    uint64_t copy, 
-    uint64_t k, 
+// Proves rounds 1.. from the once-folded vectors, whose row i in round 1 is
+// entries [i * s1, (i + 1) * s1) of either side
+void fliop_folded(uint64_t* folded_left, uint64_t* folded_right, const vector<uint64_t>& ks, const vector<uint64_t>& lengths, uint64_t* rands, ProverTranscript* transcript, LagrangeCache& tables, Arena& arena, ThreadPool* pool, InterpolationEngine engine, Proof& proof) {
+    uint64_t k1 = round_k(ks, 1);
+    uint64_t s1 = lengths[1];
+    uint64_t** first_left = arena.alloc<uint64_t*>(k1);
+    uint64_t** first_right = arena.alloc<uint64_t*>(k1);
+    for(int i = 0; i < k1; i++) {
+        first_left[i] = &folded_left[i * s1];
+        first_right[i] = &folded_right[i * s1];
+    }
+    uint64_t** rows_left = schedule_rows(first_left, ks, lengths, 1, arena);
+    uint64_t** rows_right = schedule_rows(first_right, ks, lengths, 1, arena);
+    fliop_rounds(rows_left, rows_right, ks, lengths, 1, rands, transcript, tables, arena, pool, engine, proof);
+}
+
+// Points left and right at triple positions [j0, j0 + len) of round-0 row i
+// of both sides, 2 * len entries each laid out as shape() lays out the rows.
+// They come in pointing at buffers of that size, which the loader either
+// fills or replaces with pointers into rows it already holds. column is
+// scratch for len entries.
+typedef function<void(uint64_t, uint64_t, uint64_t, uint64_t*&, uint64_t*&, uint64_t*)> RowLoader;
+
+// Positions per block of round 0 in fliop_rows(); blocks start at multiples
+// of it
+const uint64_t ROUND0_BLOCK = 512;
+
+// Proves T triples whose round-0 rows come from load, which is called from
+// several threads at once. Round 0 reads the rows twice in blocks, once for
+// its sums and once to fold them with the round's challenge. The input is
+// never written: triple t = i * s + j carries eta^(i * s) * eta^j, the row
+// factor is applied to the sums (or fold coefficients) and the position
+// factor to a copy of the block (or the folded entries). The rounds after the
+// first run in place on the once-folded vector (2 * T / ks[0] entries per
+// side).
+Proof fliop_rows(const RowLoader& load, uint64_t copy, const vector<uint64_t>& ks, uint64_t* rands, ProverTranscript* transcript, LagrangeCache& tables, Arena& arena, ThreadPool* pool, InterpolationEngine engine) {
+    const uint64_t block = ROUND0_BLOCK;
+    uint64_t T = copy;
+    uint64_t k = ks[0];
+    uint64_t s = (T - 1) / k + 1;
+    // uint64_t eta = generate_challenge();
+    if (transcript != nullptr) {
+        rands[0] = transcript->eta();
+    }
+    uint64_t eta = rands[0];
+    vector<uint64_t> lengths = round_lengths(T, ks);
+    const LagrangeTable& lagrange = tables.get(k);
+    InterpolationEngine round_engine = choose_engine(k, engine);
+    uint64_t size = p_sums_size(k, round_engine);
+    uint64_t scratch_size = p_sums_scratch_size(lagrange);
+    uint64_t chunks = num_chunks_of(pool);
+    if (s < chunks * 1024) {
+        chunks = 1;
+    }
+    ArenaScope scope(arena);
+    uint64_t* row_eta = arena.alloc<uint64_t>(k);
+    uint64_t eta_s = pow_modp(eta, s);
+    row_eta[0] = 1;
+    for(int i = 1; i < k; i++) {
+        row_eta[i] = mul_modp(row_eta[i - 1], eta_s);
+    }
+    Proof result;
+    draw_mask_seed(result);
+
+    // Calls body(chunk, left, right, weights, j0, len) on every block of
+    // positions, each thread with its own buffers; weights[m] = eta^(j0 + m / 2)
+    uint64_t chunk_words = 4 * k * block + 3 * block;
+    uint64_t* chunk_buffers = arena.alloc<uint64_t>(chunks * chunk_words);
+    uint64_t** chunk_rows = arena.alloc<uint64_t*>(chunks * 2 * k);
+    auto for_each_block = [&](const function<void(uint64_t, uint64_t**, uint64_t**, uint64_t*, uint64_t, uint64_t)>& body) {
+        parallel_for(pool, s, chunks, [&](uint64_t c, uint64_t start, uint64_t end) {
+            uint64_t* buffer = &chunk_buffers[c * chunk_words];
+            uint64_t* column = buffer + 4 * k * block;
+            uint64_t* weights = column + block;
+            uint64_t** left = &chunk_rows[c * 2 * k];
+            uint64_t** right = left + k;
+            uint64_t eta_power = pow_modp(eta, start);
+            uint64_t len;
+            for(uint64_t j0 = start; j0 < end; j0 += len) {
+                len = (j0 / block + 1) * block < end ? block - j0 % block : end - j0;
+                for(int i = 0; i < k; i++) {
+                    left[i] = &buffer[2 * i * block];
+                    right[i] = &buffer[2 * (k + i) * block];
+                    load(i, j0, len, left[i], right[i], column);
+                }
+                eta_power = pair_powers(eta_power, eta, len, column, weights);
+                body(c, left, right, weights, j0, len);
+            }
+        });
+    };
+
+    begin_time = wall_time();
+    uint128_t* acc = arena.alloc_zero<uint128_t>(chunks * size);
+    uint64_t* products = arena.alloc<uint64_t>(chunks * size);
+    uint64_t* scratch = arena.alloc<uint64_t>(chunks * scratch_size);
+    uint64_t* tiles = arena.alloc<uint64_t>(chunks * 2 * k * block);
+    uint64_t** tile_rows = arena.alloc<uint64_t*>(chunks * k);
+    uint64_t* sums = arena.alloc<uint64_t>(size);
+    for_each_block([&](uint64_t c, uint64_t** left, uint64_t** right, uint64_t* weights, uint64_t j0, uint64_t len) {
+        uint64_t** tile = &tile_rows[c * k];
+        for(int i = 0; i < k; i++) {
+            tile[i] = &tiles[(c * k + i) * 2 * block];
+            batch_mul_modp(left[i], weights, tile[i], 2 * len);
+            if (round_engine == INTERP_EXTEND) {
+                for(int j = 0; j < 2 * len; j++) {
+                    tile[i][j] = mul_modp(tile[i][j], row_eta[i]);
+                }
+            }
+        }
+        slice_p_sums(tile, right, k, 0, 2 * len, round_engine, lagrange, &scratch[c * scratch_size], &products[c * size]);
+        for(int i = 0; i < size; i++) {
+            acc[c * size + i] += products[c * size + i];
+        }
+    });
+    for(int i = 0; i < size; i++) {
+        uint128_t sum = 0;
+        for(int c = 0; c < chunks; c++) {
+            sum += modp_128(acc[c * size + i]);
+        }
+        sums[i] = modp_128(sum);
+        if (round_engine == INTERP_GRAM) {
+            sums[i] = mul_modp(sums[i], row_eta[i / k]);
+        }
+    }
+    finish_time = wall_time();
+    log_out()<<"Prepare Input + Inner Product Time = "<<finish_time-begin_time<<"ms"<<endl;
+
+    log_out()<<"s : "<<lengths[0]<<endl;
+    log_out()<<"k : "<<k<<endl;
+    prove_round(sums, k, round_engine, lagrange, result, arena);
+    draw_round_challenge(transcript, result, 1, rands);
+
+    // Row i of round 1 is entries [i * s1, (i + 1) * s1) of the folded vector
+    begin_time = wall_time();
+    uint64_t* eval_base = arena.alloc<uint64_t>(k);
+    uint64_t* eval_base_left = arena.alloc<uint64_t>(k);
+    lagrange.evaluate(rands[1], eval_base);
+    for(int i = 0; i < k; i++) {
+        eval_base_left[i] = mul_modp(eval_base[i], row_eta[i]);
+    }
+    uint64_t k1 = round_k(ks, 1);
+    uint64_t s1 = lengths[1];
+    uint64_t* folded_left = arena.alloc<uint64_t>(k1 * s1);
+    uint64_t* folded_right = arena.alloc<uint64_t>(k1 * s1);
+    for(uint64_t j = lengths[0]; j < k1 * s1; j++) {
+        folded_left[j] = 0;
+        folded_right[j] = 0;
+    }
+    for_each_block([&](uint64_t c, uint64_t** left, uint64_t** right, uint64_t* weights, uint64_t j0, uint64_t len) {
+        fold_modp(left, eval_base_left, k, 0, 2 * len, &folded_left[2 * j0]);
+        batch_mul_modp(&folded_left[2 * j0], weights, &folded_left[2 * j0], 2 * len);
+        fold_modp(right, eval_base, k, 0, 2 * len, &folded_right[2 * j0]);
+    });
+    finish_time = wall_time();
+    log_out()<<"Fold Input Time = "<<finish_time-begin_time<<"ms"<<endl;
+
+    fliop_folded(folded_left, folded_right, ks, lengths, rands, transcript, tables, arena, pool, engine, result);
+    return result;
+}
+
+// Proves the batch with compression factor round_k(ks, r) in round r. The
+// shaped rows are split by ks[0] and left untouched; every later round
+// re-splits the folded vector into as many rows as its own factor asks for.
+Proof fliop(uint64_t** input_left, uint64_t** input_right, uint64_t var, uint64_t copy, const vector<uint64_t>& ks, uint64_t sid, uint64_t* rands, ProverTranscript* transcript, LagrangeCache& tables, Arena& arena, ThreadPool* pool, InterpolationEngine engine) {
+    return fliop_rows([&](uint64_t i, uint64_t j0, uint64_t len, uint64_t*& left, uint64_t*& right, uint64_t* column) {
+        left = input_left[i] + 2 * j0;
+        right = input_right[i] + 2 * j0;
+    }, copy, ks, rands, transcript, tables, arena, pool, engine);
+}
+
+// Proves T triples streamed from read without materializing them; only the
+// once-folded vector stays in memory. The proof is the same as fliop() gives
+// for the shaped input.
+Proof fliop_stream(const TripleReader& read, uint64_t var, uint64_t copy, const vector<uint64_t>& ks, uint64_t sid, uint64_t* rands, ProverTranscript* transcript, LagrangeCache& tables, Arena& arena, ThreadPool* pool, InterpolationEngine engine) {
+    uint64_t T = copy;
+    uint64_t s = (T - 1) / ks[0] + 1;
+    const uint64_t sources[4] = {0, 2, 1, 3};
+    return fliop_rows([&](uint64_t i, uint64_t j0, uint64_t len, uint64_t*& left, uint64_t*& right, uint64_t* column) {
+        uint64_t t0 = i * s + j0;
+        uint64_t n = t0 >= T ? 0 : (T - t0 < len ? T - t0 : len);
+        for(int c = 0; c < 4; c++) {
+            uint64_t* row = c < 2 ? left : right;
+            read(sources[c], t0, n, column);
+            for(int j = 0; j < n; j++) {
+                row[2 * j + c % 2] = column[j];
+            }
+            for(int j = n; j < len; j++) {
+                row[2 * j + c % 2] = 0;
+            }
+        }
+    }, copy, ks, rands, transcript, tables, arena, pool, engine);
+}
+
+// Layout of the prover's round-0 rows: k rows per side as shape() leaves
+// them, or tiled (see TiledRows)
+enum RowLayout {
+    LAYOUT_ROWS = 0,
+    LAYOUT_TILED = 1
+};
+
+// Round-0 rows cut into tiles of ROUND0_BLOCK positions: tile b holds the
+// entries of positions [b * ROUND0_BLOCK, (b + 1) * ROUND0_BLOCK) of the k
+// left rows followed by those of the k right rows, each laid out as in
+// shape(). A block of fliop_rows() is then one contiguous, 64-byte aligned
+// region instead of 2k segments s entries apart; its blocks never straddle
+// two tiles.
+struct TiledRows {
+    uint64_t k = 0, s = 0, tiles = 0;
+    uint64_t* data = nullptr;
+
+    TiledRows() {}
+    TiledRows(const TiledRows&) = delete;
+    TiledRows& operator=(const TiledRows&) = delete;
+    ~TiledRows() {
+        free(data);
+    }
+
+    // Row i of side (0 left, 1 right) within tile b
+    uint64_t* row(uint64_t side, uint64_t i, uint64_t b) const {
+        return data + ((b * 2 + side) * k + i) * 2 * ROUND0_BLOCK;
+    }
+};
+
+// Lays columns 0..3 of T triples from read out as tiled rows
+void shape_tiled(const TripleReader& read, uint64_t T, uint64_t k, TiledRows& rows) {
+    const uint64_t sources[4] = {0, 2, 1, 3};
+    rows.k = k;
+    rows.s = (T - 1) / k + 1;
+    rows.tiles = (rows.s - 1) / ROUND0_BLOCK + 1;
+    free(rows.data);
+    rows.data = (uint64_t*)aligned_alloc(64, rows.tiles * 4 * k * ROUND0_BLOCK * sizeof(uint64_t));
+    vector<uint64_t> column(ROUND0_BLOCK);
+    for(uint64_t b = 0; b < rows.tiles; b++) {
+        uint64_t j0 = b * ROUND0_BLOCK;
+        for(uint64_t i = 0; i < k; i++) {
+            uint64_t t0 = i * rows.s + j0;
+            uint64_t len = j0 + ROUND0_BLOCK < rows.s ? ROUND0_BLOCK : rows.s - j0;
+            uint64_t n = t0 >= T || j0 >= rows.s ? 0 : (T - t0 < len ? T - t0 : len);
+            for(int c = 0; c < 4; c++) {
+                uint64_t* row = rows.row(c / 2, i, b);
+                read(sources[c], t0, n, column.data());
+                for(uint64_t j = 0; j < ROUND0_BLOCK; j++) {
+                    row[2 * j + c % 2] = j < n ? column[j] : 0;
+                }
+            }
+        }
+    }
+}
+
+// Proves T triples from tiled rows; the proof is the same as fliop() gives
+// for the shaped input
+Proof fliop_tiled(const TiledRows& rows, uint64_t copy, const vector<uint64_t>& ks, uint64_t* rands, ProverTranscript* transcript, LagrangeCache& tables, Arena& arena, ThreadPool* pool, InterpolationEngine engine) {
+    return fliop_rows([&](uint64_t i, uint64_t j0, uint64_t len, uint64_t*& left, uint64_t*& right, uint64_t* column) {
+        uint64_t b = j0 / ROUND0_BLOCK;
+        left = rows.row(0, i, b) + 2 * (j0 % ROUND0_BLOCK);
+        right = rows.row(1, i, b) + 2 * (j0 % ROUND0_BLOCK);
+    }, copy, ks, rands, transcript, tables, arena, pool, engine);
+}
+
+// The product inputs of T binary triples shaped into k rows as shape() lays
+// them out, one bit per entry: bit j % 64 of word j / 64 of row(c, i) is
+// input[c] of triple i * s + j, and padding triples are 0. Half a byte per
+// triple, where the shaped left and right rows take 32 bytes.
+struct BitRows {
+    uint64_t k = 0, s = 0, words = 0;
+    vector<uint64_t> data;
+
+    uint64_t* row(uint64_t c, uint64_t i) {
+        return &data[(c * k + i) * words];
+    }
+
+    const uint64_t* row(uint64_t c, uint64_t i) const {
+        return &data[(c * k + i) * words];
+    }
+};
+
+// Packs columns 0..3 of T triples from read into k rows of bits. Prints the
+// reason and returns false if an entry is neither 0 nor 1.
+bool pack_bits(const TripleReader& read, uint64_t T, uint64_t k, BitRows& bits) {
+    const uint64_t block = 4096;
+    bits.k = k;
+    bits.s = (T - 1) / k + 1;
+    bits.words = (bits.s - 1) / 64 + 1;
+    bits.data.assign(4 * k * bits.words, 0);
+    vector<uint64_t> column(block);
+    for(uint64_t i = 0; i < k; i++) {
+        uint64_t n = i * bits.s >= T ? 0 : (T - i * bits.s < bits.s ? T - i * bits.s : bits.s);
+        for(uint64_t j0 = 0; j0 < n; j0 += block) {
+            uint64_t len = j0 + block < n ? block : n - j0;
+            for(int c = 0; c < 4; c++) {
+                uint64_t* row = bits.row(c, i);
+                read(c, i * bits.s + j0, len, column.data());
+                for(uint64_t j = 0; j < len; j++) {
+                    if (column[j] > 1) {
+                        cout << "input[" << c << "] of triple " << i * bits.s + j0 + j << " is not a bit" << endl;
+                        return false;
+                    }
+                    row[(j0 + j) / 64] |= column[j] << ((j0 + j) % 64);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// out[m] = sum of values[b] over the bits b of m, for m < 2^n, unreduced;
+// n <= 8 keeps the sums below 2^64
+void subset_sums(const uint64_t* values, uint64_t n, uint64_t* out) {
+    out[0] = 0;
+    for(uint64_t m = 1; m < (1ULL << n); m++) {
+        out[m] = out[m & (m - 1)] + values[__builtin_ctzll(m)];
+    }
+}
+
+// Proves T binary triples from their packed rows (bits.k = ks[0]). The proof
+// is the same as fliop() gives for the shaped input, but round 0 works on the
+// words. Its Gram sums cut the eta weights of a word's 64 positions into 16
+// nibbles and tabulate the 16 subset sums of each, so a pair of rows costs
+// two lookups per nibble of the ANDed words instead of 128 products. The fold
+// tabulates the 256 subset sums of every 8 fold coefficients and looks up
+// the bits of the k rows at each position. The first field elements are the
+// once-folded vector.
+Proof fliop_bits(const BitRows& bits, uint64_t copy, const vector<uint64_t>& ks, uint64_t* rands, ProverTranscript* transcript, LagrangeCache& tables, Arena& arena, ThreadPool* pool, InterpolationEngine engine) {
+    uint64_t k = bits.k;
+    uint64_t s = bits.s;
+    uint64_t words = bits.words;
+    if (transcript != nullptr) {
+        rands[0] = transcript->eta();
+    }
+    uint64_t eta = rands[0];
+    vector<uint64_t> lengths = round_lengths(copy, ks);
+    const LagrangeTable& lagrange = tables.get(k);
+    uint64_t chunks = num_chunks_of(pool);
+    if (s < chunks * 1024) {
+        chunks = 1;
+    }
+    ArenaScope scope(arena);
+    uint64_t* row_eta = arena.alloc<uint64_t>(k);
+    uint64_t eta_s = pow_modp(eta, s);
+    row_eta[0] = 1;
+    for(int i = 1; i < k; i++) {
+        row_eta[i] = mul_modp(row_eta[i - 1], eta_s);
+    }
+    Proof result;
+    draw_mask_seed(result);
+
+    // Calls body(chunk, powers, w) on every word w, powers[t] = eta^(64w + t)
+    uint64_t* chunk_powers = arena.alloc<uint64_t>(chunks * 64);
+    auto for_each_word = [&](const function<void(uint64_t, const uint64_t*, uint64_t)>& body) {
+        parallel_for(pool, words, chunks, [&](uint64_t c, uint64_t start, uint64_t end) {
+            uint64_t* powers = &chunk_powers[c * 64];
+            uint64_t eta_power = pow_modp(eta, 64 * start);
+            for(uint64_t w = start; w < end; w++) {
+                powers_modp(eta_power, eta, 64, powers);
+                eta_power = mul_modp(powers[63], eta);
+                body(c, powers, w);
+            }
+        });
+    };
+
+    begin_time = wall_time();
+    uint128_t* acc = arena.alloc_zero<uint128_t>(chunks * k * k);
+    uint64_t* nibble_sums = arena.alloc<uint64_t>(chunks * 256);
+    uint64_t* sums = arena.alloc<uint64_t>(k * k);
+    for_each_word([&](uint64_t c, const uint64_t* powers, uint64_t w) {
+        uint64_t* table = &nibble_sums[c * 256];
+        for(int n = 0; n < 16; n++) {
+            subset_sums(&powers[4 * n], 4, &table[16 * n]);
+        }
+        for(uint64_t i = 0; i < k; i++) {
+            uint64_t x0 = bits.row(0, i)[w];
+            uint64_t x2 = bits.row(2, i)[w];
+            for(uint64_t j = 0; j < k; j++) {
+                uint64_t a = x0 & bits.row(1, j)[w];
+                uint64_t b = x2 & bits.row(3, j)[w];
+                if ((a | b) == 0) {
+                    continue;
+                }
+                uint128_t sum = 0;
+                for(int n = 0; n < 16; n++) {
+                    sum += table[16 * n + ((a >> (4 * n)) & 15)] + table[16 * n + ((b >> (4 * n)) & 15)];
+                }
+                acc[c * k * k + i * k + j] += sum;
+            }
+        }
+    });
+    for(int i = 0; i < k * k; i++) {
+        uint128_t sum = 0;
+        for(int c = 0; c < chunks; c++) {
+            sum += modp_128(acc[c * k * k + i]);
+        }
+        sums[i] = mul_modp(modp_128(sum), row_eta[i / k]);
+    }
+    finish_time = wall_time();
+    log_out()<<"Prepare Input + Inner Product Time = "<<finish_time-begin_time<<"ms"<<endl;
+
+    log_out()<<"s : "<<lengths[0]<<endl;
+    log_out()<<"k : "<<k<<endl;
+    prove_round(sums, k, INTERP_GRAM, lagrange, result, arena);
+    draw_round_challenge(transcript, result, 1, rands);
+
+    // Column c of triple j lands in entry 2j + c / 2 of the left (c even) or
+    // right (c odd) folded vector
+    begin_time = wall_time();
+    uint64_t* eval_base = arena.alloc<uint64_t>(k);
+    uint64_t* eval_base_left = arena.alloc<uint64_t>(k);
+    lagrange.evaluate(rands[1], eval_base);
+    for(int i = 0; i < k; i++) {
+        eval_base_left[i] = mul_modp(eval_base[i], row_eta[i]);
+    }
+    uint64_t groups = (k - 1) / 8 + 1;
+    uint64_t* fold_sums = arena.alloc<uint64_t>(2 * groups * 256);
+    for(uint64_t g = 0; g < groups; g++) {
+        uint64_t n = k - 8 * g < 8 ? k - 8 * g : 8;
+        subset_sums(&eval_base_left[8 * g], n, &fold_sums[g * 256]);
+        subset_sums(&eval_base[8 * g], n, &fold_sums[(groups + g) * 256]);
+    }
+    uint64_t k1 = round_k(ks, 1);
+    uint64_t s1 = lengths[1];
+    uint64_t* folded_left = arena.alloc<uint64_t>(k1 * s1);
+    uint64_t* folded_right = arena.alloc<uint64_t>(k1 * s1);
+    for(uint64_t j = lengths[0]; j < k1 * s1; j++) {
+        folded_left[j] = 0;
+        folded_right[j] = 0;
+    }
+    // Byte t of spread[m] is bit t of m, so the bits of 8 positions of up to
+    // 8 rows turn into their 8 table indices with a lookup per row
+    uint64_t spread[256];
+    for(uint64_t m = 0; m < 256; m++) {
+        spread[m] = 0;
+        for(int t = 0; t < 8; t++) {
+            spread[m] |= ((m >> t) & 1) << (8 * t);
+        }
+    }
+    uint8_t* chunk_index = arena.alloc<uint8_t>(chunks * groups * 64);
+    uint64_t* chunk_entries = arena.alloc<uint64_t>(chunks * 3 * 128);
+    for_each_word([&](uint64_t c, const uint64_t* powers, uint64_t w) {
+        uint8_t* index = &chunk_index[c * groups * 64];
+        uint64_t* entries = &chunk_entries[c * 3 * 128];
+        uint64_t* weights = entries + 2 * 128;
+        uint64_t len = 64 * w + 64 < s ? 64 : s - 64 * w;
+        for(int column = 0; column < 4; column++) {
+            for(uint64_t g = 0; g < groups; g++) {
+                for(int b = 0; b < 8; b++) {
+                    uint64_t packed = 0;
+                    for(uint64_t i = 8 * g; i < k && i < 8 * g + 8; i++) {
+                        packed |= spread[(bits.row(column, i)[w] >> (8 * b)) & 255] << (i % 8);
+                    }
+                    memcpy(&index[g * 64 + 8 * b], &packed, 8);
+                }
+            }
+            const uint64_t* table = &fold_sums[(column % 2) * groups * 256];
+            uint64_t* side = &entries[(column % 2) * 128 + column / 2];
+            if (groups == 1) {
+                for(uint64_t t = 0; t < len; t++) {
+                    side[2 * t] = modp(table[index[t]]);
+                }
+                continue;
+            }
+            for(uint64_t t = 0; t < len; t++) {
+                uint128_t sum = 0;
+                for(uint64_t g = 0; g < groups; g++) {
+                    sum += table[g * 256 + index[g * 64 + t]];
+                }
+                side[2 * t] = modp_128(sum);
+            }
+        }
+        for(uint64_t t = 0; t < len; t++) {
+            weights[2 * t] = powers[t];
+            weights[2 * t + 1] = powers[t];
+        }
+        batch_mul_modp(entries, weights, &folded_left[128 * w], 2 * len);
+        memcpy(&folded_right[128 * w], entries + 128, 2 * len * sizeof(uint64_t));
+    });
+    finish_time = wall_time();
+    log_out()<<"Fold Input Time = "<<finish_time-begin_time<<"ms"<<endl;
+
+    fliop_folded(folded_left, folded_right, ks, lengths, rands, transcript, tables, arena, pool, engine, result);
+    return result;
+}
+
+// Where an OnlineProver gets the verifiers' coin of block b. It is called on
+// the prover's own thread once all of block b's triples are appended, and may
+// wait there for the verifiers.
+typedef function<VerifierCoin(uint64_t)> CoinSource;
+
+// Session of block b of an online batch of session sid
+uint64_t block_sid(uint64_t sid, uint64_t b) {
+    return splitmix64(sid ^ splitmix64(b));
+}
+
+// Proves a batch of T triples that arrive one at a time, as the MPC engine
+// evaluates its AND gates. The batch is cut into blocks of `block` triples,
+// and every block is a proof of its own, session block_sid(sid, b), over
+// block_size(b) triples shaped as shape() shapes them. append() writes each
+// triple straight into its block's rows; once a block is full, a thread of
+// the prover takes the verifiers' coin of the block and proves it while the
+// next block fills, so its eta is only drawn after its triples are fixed.
+// finalize() is left with the last block and the ones still in flight. The
+// price is one proof per block instead of one for the batch.
+class OnlineProver {
+public:
+    OnlineProver(uint64_t T, uint64_t block, const vector<uint64_t>& ks, uint64_t sid, const CoinSource& coin, LagrangeCache& tables, InterpolationEngine engine = INTERP_AUTO)
+        : T(T), block(block), ks(ks), sid(sid), coin(coin), tables(tables), engine(engine), proofs((T - 1) / block + 1) {
+        start_block();
+        prover = thread([this] { prove_loop(); });
+    }
+
+    OnlineProver(const OnlineProver&) = delete;
+    OnlineProver& operator=(const OnlineProver&) = delete;
+
+    ~OnlineProver() {
+        {
+            unique_lock<mutex> lock(mtx);
+            stopping = true;
+        }
+        wake.notify_all();
+        prover.join();
+    }
+
+    uint64_t blocks() const {
+        return proofs.size();
+    }
+
+    uint64_t block_size(uint64_t b) const {
+        return b + 1 < blocks() ? block : T - b * block;
+    }
+
+    // Triples in the proof of block b, padding included
+    uint64_t block_copy(uint64_t b) const {
+        return ((block_size(b) - 1) / ks[0] + 1) * ks[0];
+    }
+
+    // Takes input[0..3] of the next triple
+    bool append(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3) {
+        if (count == T) {
+            cout << "OnlineProver takes only " << T << " triples" << endl;
+            return false;
+        }
+        uint64_t at = row * 2 * s + 2 * position;
+        filling->left[at] = x0;
+        filling->left[at + 1] = x2;
+        filling->right[at] = x1;
+        filling->right[at + 1] = x3;
+        count++;
+        if (++position == s) {
+            position = 0;
+            row++;
+        }
+        if (count == T || count % block == 0) {
+            {
+                unique_lock<mutex> lock(mtx);
+                queue.push_back(move(filling));
+            }
+            wake.notify_all();
+            if (count < T) {
+                start_block();
+            }
+        }
+        return true;
+    }
+
+    // Waits for the proofs of all blocks once all T triples are in
+    bool finalize(vector<Proof>& result) {
+        if (count != T) {
+            cout << "OnlineProver has " << count << " of " << T << " triples" << endl;
+            return false;
+        }
+        unique_lock<mutex> lock(mtx);
+        done.wait(lock, [this] { return proved == blocks(); });
+        result = proofs;
+        return true;
+    }
+
+private:
+    struct Block {
+        uint64_t index;
+        vector<uint64_t> left, right;
+    };
+
+    void start_block() {
+        uint64_t b = count / block;
+        s = block_copy(b) / ks[0];
+        row = 0;
+        position = 0;
+        filling.reset(new Block{b, vector<uint64_t>(2 * s * ks[0], 0), vector<uint64_t>(2 * s * ks[0], 0)});
+    }
+
+    void prove_loop() {
+        verbose = false;
+        Arena arena;
+        while(true) {
+            unique_ptr<Block> next;
+            {
+                unique_lock<mutex> lock(mtx);
+                wake.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                next = move(queue.front());
+                queue.pop_front();
+            }
+            uint64_t b = next->index;
+            uint64_t copy = block_copy(b);
+            uint64_t rows = copy / ks[0];
+            vector<uint64_t> rands(round_lengths(copy, ks).size() + 1);
+            ProverTranscript transcript(proof_transcript(block_sid(sid, b), copy, ks, coin(b)));
+            Proof proof = fliop_rows([&](uint64_t i, uint64_t j0, uint64_t len, uint64_t*& left, uint64_t*& right, uint64_t* column) {
+                left = &next->left[i * 2 * rows + 2 * j0];
+                right = &next->right[i * 2 * rows + 2 * j0];
+            }, copy, ks, rands.data(), &transcript, tables, arena, nullptr, engine);
+            {
+                unique_lock<mutex> lock(mtx);
+                proofs[b] = move(proof);
+                proved++;
+            }
+            done.notify_all();
+        }
+    }
+
+    uint64_t T, block;
+    vector<uint64_t> ks;
+    uint64_t sid;
+    CoinSource coin;
+    LagrangeCache& tables;
+    InterpolationEngine engine;
+    // The block being filled, its row length and where the next triple goes
+    unique_ptr<Block> filling;
+    uint64_t s = 0, row = 0, position = 0;
+    uint64_t count = 0;
+    // Full blocks waiting for the prover's thread
+    deque< unique_ptr<Block> > queue;
+    vector<Proof> proofs;
+    uint64_t proved = 0;
+    bool stopping = false;
+    mutex mtx;
+    condition_variable wake, done;
+    thread prover;
+};
+
+Proof prove_and_gate(uint64_t _party_id, uint64_t** input_left, uint64_t** input_right, uint64_t var, uint64_t copy, const vector<uint64_t>& ks, uint64_t sid, uint64_t* rands, LagrangeCache& tables, Arena& arena, ThreadPool* pool = nullptr, InterpolationEngine engine = INTERP_AUTO, ProverTranscript* transcript = nullptr) {
+    return fliop(input_left, input_right, var, copy, ks, sid, rands, transcript, tables, arena, pool, engine);
+}
+
+// One independent session of a batch: T triples shaped into k = ks[0] rows
+// per side, with T padded to a multiple of k as shape() leaves it. With a
+// transcript the challenges are drawn from it into rands.
+struct ProofSession {
+    uint64_t** input_left;
+    uint64_t** input_right;
+    uint64_t copy;
+    vector<uint64_t> ks;
+    uint64_t sid;
+    uint64_t* rands;
+    ProverTranscript* transcript = nullptr;
+};
+
+// Proves many sessions at once. Each thread of the pool takes whole sessions,
+// largest first so the last ones to finish are short, and proves them
+// serially with its own arena from arenas, which grows to one per thread and
+// can be kept for the next batch. All threads share tables. Timing output is
+// off while the batch runs. A single large session is better proven with
+// prove_and_gate() and the pool.
+vector<Proof> prove_batch(const vector<ProofSession>& sessions, uint64_t var, LagrangeCache& tables, vector< unique_ptr<Arena> >& arenas, ThreadPool* pool, InterpolationEngine engine = INTERP_AUTO) {
+    vector<uint64_t> order(sessions.size());
+    for(int i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    stable_sort(order.begin(), order.end(), [&](uint64_t a, uint64_t b) {
+        return sessions[a].copy > sessions[b].copy;
+    });
+    uint64_t workers = num_chunks_of(pool);
+    while(arenas.size() < workers) {
+        arenas.emplace_back(new Arena());
+    }
+    vector<Proof> proofs(sessions.size());
+    atomic<uint64_t> next{0};
+    auto work = [&](uint64_t w) {
+        bool was_verbose = verbose;
+        verbose = false;
+        while(true) {
+            uint64_t n = next.fetch_add(1);
+            if (n >= order.size()) break;
+            const ProofSession& session = sessions[order[n]];
+            proofs[order[n]] = fliop(session.input_left, session.input_right, var, session.copy, session.ks, session.sid, session.rands, session.transcript, tables, *arenas[w], nullptr, engine);
+        }
+        verbose = was_verbose;
+    };
+    if (pool == nullptr) {
+        work(0);
+    }
+    else {
+        pool->run(workers, work);
+    }
+    return proofs;
+}
+
+// Called with r before the verifier first reads rands[r] and, for r > 0,
+// its share of round r - 1, so both can arrive while it works through the
+// earlier rounds
+typedef function<void(uint64_t)> RoundWait;
+
+VerMsg gen_vermsg(
+    const vector< vector<uint64_t> >& p_eval_ss, 
+    uint64_t** input,
+    uint64_t** input_mono, 
+    uint64_t var, 
+    uint64_t copy, 
+    const vector<uint64_t>& ks, 
     uint64_t sid, 
     uint64_t* rands,
     uint64_t prover_ID,
-    uint64_t party_ID
+    uint64_t party_ID,
+    LagrangeCache& tables,
+    Arena& arena,
+    ThreadPool* pool = nullptr,
+    const RoundWait& wait = RoundWait()
 ) {
     uint64_t L = var;
     uint64_t T = copy;
+    uint64_t k = ks[0];
     uint64_t s = T / k;
-    uint64_t len = log(2 * T) / log(k) + 2;
-    
-    VerMsg self_vermsg = gen_vermsg(p_eval_ss, input, input_mono, var, copy, k, sid, rands, prover_ID, party_ID);
-    cout << "in verify_and_gates" << endl;
-    cout << "size of p_eval_ksum_ss: " << self_vermsg.p_eval_ksum_ss.size() << endl;
-    cout << "size of p_eval_r_ss: " << self_vermsg.p_eval_r_ss.size() << endl;
 
-    uint64_t p_eval_ksum, p_eval_r;
+    if (wait) {
+        wait(0);
+    }
+    uint64_t eta = rands[0];
+
+    uint64_t r, s0, k_next, cnt = 1;
+    uint128_t temp_result;
+
+    // The first fold reads the input and writes the folded vector, which the
+    // later rounds fold in place; the input itself is never written
+    vector<uint64_t> lengths = round_lengths(T, ks);
+    uint64_t len = lengths.size();
+    ArenaScope scope(arena);
+    uint64_t k_max = max_round_k(ks, lengths, 0);
+    uint64_t* eval_base = arena.alloc<uint64_t>(k_max);
+    uint64_t* eval_p_base = arena.alloc<uint64_t>(2 * k_max - 1);
+    uint64_t** rows = input;
+
+    vector<uint64_t> p_eval_ksum_ss(len);
+    vector<uint64_t> p_eval_r_ss(len);
+    uint64_t final_input;
+    uint64_t final_result_ss;
+    bool eta_pending = false;
+    // Loops over positions are split into one slice per thread of the pool
+    // once they are long enough; per-slice partial sums are added in slice
+    // order, so the VerMsg does not depend on the number of threads
+    auto chunks_for = [&](uint64_t size) {
+        uint64_t chunks = num_chunks_of(pool);
+        return size < chunks * 1024 ? 1 : chunks;
+    };
+
+    if(false) {
+        // Compute ETA
+        begin_time = wall_time();
+        uint64_t** eta_power = new uint64_t*[k];
+        for(int i = 0; i < k; i++) {
+            eta_power [i] = new uint64_t[s];
+            if (i == 0) {
+                eta_power[i][0] = 1;
+            }
+            else {
+                eta_power[i][0] = mul_modp(eta_power[i - 1][s - 1], eta); 
+            }
+            for(int j = 1; j < s; j ++) {
+                eta_power[i][j] = mul_modp(eta_power[i][j - 1], eta);
+            }
+        }
+        finish_time = wall_time();
+        log_out()<<"Compute ETA Time = "<<finish_time-begin_time<<"ms"<<endl;
+        
+        // Prepare Input
+        if ((party_ID + 1 - prover_ID) % 3 == 0) {
+            begin_time = wall_time();
+            for(int i = 0; i < k; i++) {
+                for(int j = 0; j < s; j++) {
+                    input[i][2 * j] = mul_modp(input[i][2 * j], eta_power[i][j]);
+                    input[i][2 * j + 1] = mul_modp(input[i][2 * j + 1], eta_power[i][j]);
+                }
+            }
+            finish_time = wall_time();
+            log_out()<<"Prepare Input Time = "<<finish_time-begin_time<<"ms"<<endl;
+        }
+
+        begin_time = wall_time();
+        p_eval_r_ss[0] = 0;
+        for(int i = 0; i < k; i++) {
+            p_eval_r_ss[0] += inner_productp(eta_power[i], input_mono[i], s);
+        }
+        p_eval_r_ss[0] = modp(p_eval_r_ss[0]);
+        finish_time = wall_time();
+        log_out()<<"Compute Monomial Time = "<<finish_time-begin_time<<"ms"<<endl;
+    }
+    else {
+        // The party holding the left input applies the eta powers to it in the
+        // first fold below, so the input is only read once in the first round
+        eta_pending = (party_ID + 1 - prover_ID) % 3 == 0;
+        begin_time = wall_time();
+        uint64_t eta_s = pow_modp(eta, s);
+        uint64_t chunks = chunks_for(s);
+        uint64_t* partial = arena.alloc<uint64_t>(chunks);
+        parallel_for(pool, s, chunks, [&](uint64_t c, uint64_t start, uint64_t end) {
+            uint128_t sum = 0;
+            uint64_t eta_temp = pow_modp(eta, start);
+            for(int i = 0; i < k; i++) {
+                sum += powers_inner_productp(input_mono[i] + start, eta_temp, eta, end - start);
+                eta_temp = mul_modp(eta_temp, eta_s);
+            }
+            partial[c] = modp_128(sum);
+        });
+        temp_result = 0;
+        for(int c = 0; c < chunks; c++) {
+            temp_result += partial[c];
+        }
+        p_eval_r_ss[0] = modp_128(temp_result);
+        finish_time = wall_time();
+        log_out()<<"Compute Monomial Time = "<<finish_time-begin_time<<"ms"<<endl;
+    }
+
+    s *= 2;
+    while(true)
+    {
+        log_out()<<"s : "<<s<<endl;
+        log_out()<<"k : "<<k<<endl;
+        if (wait) {
+            wait(cnt);
+        }
+
+        // Compute share of sum of p's evaluations over [0, k - 1]
+        uint128_t res = 0;
+        for(int j = 0; j < k; j++) {
+            res += p_eval_ss[cnt - 1][j];
+        }
+        p_eval_ksum_ss[cnt - 1] = modp_128(res);
+
+        const LagrangeTable& lagrange = tables.get(k);
+        const LagrangeTable& lagrange_p = tables.get(2 * k - 1);
+        if(s == 1) {
+            r = rands[cnt];
+            lagrange.evaluate(r, eval_base);
+            fold_modp(rows, eval_base, k, 0, 1, &final_input);
+            lagrange_p.evaluate(r, eval_p_base);
+            final_result_ss = inner_productp(eval_p_base, p_eval_ss[cnt - 1].data(), 2 * k - 1);
+            break;
+        }
+
+        // Compute share of p's evaluation at r
+        r = rands[cnt];
+        lagrange_p.evaluate(r, eval_p_base);
+        p_eval_r_ss[cnt] = inner_productp(eval_p_base, p_eval_ss[cnt - 1].data(), 2 * k - 1);
+
+        // Compute New Input
+        begin_time = wall_time();
+        lagrange.evaluate(r, eval_base);
+        s0 = s;
+        s = lengths[cnt];
+        k_next = round_k(ks, cnt);
+        if (cnt == 1) {
+            // Row i of round 1 is entries [i * s, (i + 1) * s) of the folded
+            // vector. Entry m of input row l carries eta^(l * s0 / 2 + m / 2)
+            // for the party that applies eta: the row factor goes into its
+            // fold coefficient, the position factor is applied once per
+            // folded entry.
+            if (eta_pending) {
+                uint64_t row_eta = pow_modp(eta, s0 / 2);
+                uint64_t eta_temp = 1;
+                for(int l = 0; l < k; l++) {
+                    eval_base[l] = mul_modp(eval_base[l], eta_temp);
+                    eta_temp = mul_modp(eta_temp, row_eta);
+                }
+            }
+            // Each slice is folded and weighted a block at a time, starting
+            // from eta^(start / 2); slices start at even positions
+            const uint64_t block = 512;
+            uint64_t* folded = arena.alloc<uint64_t>(k_next * s);
+            uint64_t chunks = chunks_for(s0);
+            uint64_t* scratch = arena.alloc<uint64_t>(chunks * 3 * block);
+            parallel_for(pool, s0, chunks, [&](uint64_t c, uint64_t start, uint64_t end) {
+                uint64_t* powers = &scratch[c * 3 * block];
+                uint64_t* weights = powers + block;
+                uint64_t eta_temp = eta_pending ? pow_modp(eta, start / 2) : 1;
+                for(uint64_t m = start; m < end; m += 2 * block) {
+                    uint64_t size = m + 2 * block < end ? 2 * block : end - m;
+                    fold_modp(rows, eval_base, k, m, size, &folded[m]);
+                    if (eta_pending) {
+                        eta_temp = pair_powers(eta_temp, eta, size / 2, powers, weights);
+                        batch_mul_modp(&folded[m], weights, &folded[m], size);
+                    }
+                }
+            });
+            for(int m = s0; m < k_next * s; m++) {
+                folded[m] = 0;
+            }
+            uint64_t** first = arena.alloc<uint64_t*>(k_next);
+            for(int i = 0; i < k_next; i++) {
+                first[i] = &folded[i * s];
+            }
+            rows = schedule_rows(first, ks, lengths, 1, arena);
+        }
+        else {
+            // Position t of a row is only read when folding position t of
+            // row 0, which comes first in the same slice, so slices can fold
+            // in place side by side
+            parallel_for(pool, s, chunks_for(s), [&](uint64_t c, uint64_t start, uint64_t end) {
+                for(int i = 0; i < k_next; i++) {
+                    uint64_t index = i * s + start;
+                    uint64_t valid = index >= s0 ? 0 : (s0 - index < end - start ? s0 - index : end - start);
+                    fold_modp(rows, eval_base, k, index, valid, rows[i] + start);
+                    for(uint64_t j = start + valid; j < end; j++) {
+                        rows[i][j] = 0;
+                    }
+                }
+            });
+        }
+        k = k_next;
+        finish_time = wall_time();
+        log_out()<<"Prepare Input Time = "<<finish_time-begin_time<<"ms"<<endl;
+
+        cnt++;
+    }
+
+    VerMsg vermsg = {
+        p_eval_ksum_ss,
+        p_eval_r_ss,
+        final_input,
+        final_result_ss
+    };
+    log_out() << "exiting gen_vermsg()" << endl;
+    return vermsg;
+}
+
+// Combines this verifier's VerMsg with the other's: every round's sum of
+// P over [0, k - 1] must be the previous round's P at r, and the last P at r
+// the product of the folded inputs
+bool check_vermsgs(const VerMsg& self_vermsg, const VerMsg& other_vermsg, uint64_t prover_ID, uint64_t party_ID) {
+    uint64_t len = self_vermsg.p_eval_ksum_ss.size();
+    log_out() << "size of p_eval_ksum_ss: " << self_vermsg.p_eval_ksum_ss.size() << endl;
+    log_out() << "size of p_eval_r_ss: " << self_vermsg.p_eval_r_ss.size() << endl;
+
+    uint64_t p_eval_ksum, p_eval_r;
+
+    if (other_vermsg.p_eval_ksum_ss.size() != len) {
+        cout << "VerMsgs have different numbers of rounds" << endl;
+        return false;
+    }
+    for(int i = 0; i < len; i++) {
+        p_eval_ksum = add_modp(self_vermsg.p_eval_ksum_ss[i], other_vermsg.p_eval_ksum_ss[i]);
+        p_eval_r = add_modp(self_vermsg.p_eval_r_ss[i], other_vermsg.p_eval_r_ss[i]);
+        if(p_eval_ksum != p_eval_r) {
+            cout << i << "-th sum check didn't pass" << endl;
+            return false;
+        }
+    }
+    uint64_t last_input_left;
+    uint64_t last_input_right;
+    if((party_ID + 1 - prover_ID) % 3 == 0) {
+        last_input_left = self_vermsg.final_input;
+        last_input_right = other_vermsg.final_input;
+    }
+    else {
+        last_input_left = other_vermsg.final_input;
+        last_input_right = self_vermsg.final_input;
+    }
+    uint64_t res = mul_modp(last_input_left, last_input_right);
+    p_eval_r = add_modp(self_vermsg.final_result_ss, other_vermsg.final_result_ss);
+    
+    if(res != p_eval_r) {
+        cout << "last check didn't pass" << endl;
+        return false;
+    }
+    
+    return true;
+}
+
+bool verify_and_gates(
+    const vector< vector<uint64_t> >& p_eval_ss, 
+    uint64_t** input,
+    uint64_t** input_mono, 
+    const VerMsg& other_vermsg, 
+    uint64_t var, 
+    uint64_t copy, 
+    const vector<uint64_t>& ks, 
+    uint64_t sid, 
+    uint64_t* rands,
+    uint64_t prover_ID,
+    uint64_t party_ID,
+    LagrangeCache& tables,
+    Arena& arena,
+    ThreadPool* pool = nullptr
+) {
+    VerMsg self_vermsg = gen_vermsg(p_eval_ss, input, input_mono, var, copy, ks, sid, rands, prover_ID, party_ID, tables, arena, pool);
+    log_out() << "in verify_and_gates" << endl;
+    return check_vermsgs(self_vermsg, other_vermsg, prover_ID, party_ID);
+}
+
+// Lays the T triples out as k rows per side. Row i holds triples [i * s,
+// (i + 1) * s): entries 2j and 2j + 1 of a left row are input[0] and input[2]
+// of its triple j, of a right row input[1] and input[3], and the mono rows
+// hold input[4] and input[5]. Triples past T are zero padding. With a pool,
+// every thread writes the positions of its parallel_for() chunk in all
+// rows, so with a pinned pool each chunk is first touched, and placed, on
+// the node of the thread that later folds it.
+void shape(
+    const TripleReader& read, 
+    uint64_t L, 
+    uint64_t T, 
+    uint64_t k, 
+    uint64_t** &input_left,
+    uint64_t** &input_right, 
+    uint64_t** &input_mono_left,
+    uint64_t** &input_mono_right,
+    ThreadPool* pool = nullptr
+) {
+    const uint64_t block = 4096;
+    const uint64_t sources[4] = {0, 2, 1, 3};
+    uint64_t s = (T - 1) / k + 1;
+
+    uint64_t* meta_left = new uint64_t[2 * s * k];
+    uint64_t* meta_right = new uint64_t[2 * s * k];
+    uint64_t* meta_mono_left = new uint64_t[s * k];
+    uint64_t* meta_mono_right = new uint64_t[s * k];
+    input_left = new uint64_t*[k];
+    input_right = new uint64_t*[k];
+    input_mono_left = new uint64_t*[k];
+    input_mono_right = new uint64_t*[k];
+    for(int i = 0; i < k; i++) {
+        input_left[i] = meta_left + i * 2 * s;
+        input_right[i] = meta_right + i * 2 * s;
+        input_mono_left[i] = meta_mono_left + i * s;
+        input_mono_right[i] = meta_mono_right + i * s;
+    }
+    parallel_for(pool, s, num_chunks_of(pool), [&](uint64_t chunk, uint64_t start, uint64_t end) {
+        vector<uint64_t> column(block);
+        for(int i = 0; i < k; i++) {
+            uint64_t n = i * s >= T ? 0 : (T - i * s < s ? T - i * s : s);
+            uint64_t stop = n < end ? n : end;
+            for(uint64_t j0 = start; j0 < stop; j0 += block) {
+                uint64_t len = j0 + block < stop ? block : stop - j0;
+                for(int c = 0; c < 4; c++) {
+                    uint64_t* row = c < 2 ? input_left[i] : input_right[i];
+                    read(sources[c], i * s + j0, len, column.data());
+                    for(int j = 0; j < len; j++) {
+                        row[2 * (j0 + j) + c % 2] = column[j];
+                    }
+                }
+                read(4, i * s + j0, len, input_mono_left[i] + j0);
+                read(5, i * s + j0, len, input_mono_right[i] + j0);
+            }
+            for(uint64_t j = stop > start ? stop : start; j < end; j++) {
+                input_left[i][2 * j] = 0;
+                input_left[i][2 * j + 1] = 0;
+                input_right[i][2 * j] = 0;
+                input_right[i][2 * j + 1] = 0;
+                input_mono_left[i][j] = 0;
+                input_mono_right[i][j] = 0;
+            }
+        }
+    });
+}
+
+void shape(
+    uint64_t** input, 
+    uint64_t L, 
+    uint64_t T, 
+    uint64_t k, 
+    uint64_t** &input_left,
+    uint64_t** &input_right, 
+    uint64_t** &input_mono_left,
+    uint64_t** &input_mono_right
+) {
+    shape(memory_reader(input), L, T, k, input_left, input_right, input_mono_left, input_mono_right);
+}
+
+void free_shape(
+    uint64_t k,
+    uint64_t** input_left,
+    uint64_t** input_right,
+    uint64_t** input_mono_left,
+    uint64_t** input_mono_right
+) {
+    delete[] input_left[0];
+    delete[] input_right[0];
+    delete[] input_mono_left[0];
+    delete[] input_mono_right[0];
+    delete[] input_left;
+    delete[] input_right;
+    delete[] input_mono_left;
+    delete[] input_mono_right;
+}
+
+// Generates L columns of T satisfying triples:
+// input[4] + input[5] = input[0] * input[1] + input[2] * input[3]
+uint64_t** generate_inputs(uint64_t L, uint64_t T) {
+    uint64_t** input = new uint64_t*[L];
+    for(int i = 0; i < L - 1; i++) {
+        input[i] = new uint64_t[T];
+        thread_prg().fill_field(input[i], T);
+    }
+    input[L - 1] = new uint64_t[T];
+    for(int j = 0; j < T; j++) {
+        uint128_t temp_res = (uint128_t)input[0][j] * (uint128_t)input[1][j] + (uint128_t)input[2][j] * (uint128_t)input[3][j];   
+        input[L - 1][j] = modp_128(temp_res);
+        if (input[L - 1][j] > input[L - 2][j]) {
+            input[L - 1][j] = input[L - 1][j] - input[L - 2][j];
+        }
+        else {
+            input[L - 1][j] = PR - input[L - 2][j] + input[L - 1][j];
+        }
+    }
+    return input;
+}
+
+void free_inputs(uint64_t** input, uint64_t L) {
+    for(int i = 0; i < L; i++) {
+        delete[] input[i];
+    }
+    delete[] input;
+}
+
+uint64_t* generate_rands(uint64_t T, const vector<uint64_t>& ks) {
+    uint64_t cnt = round_lengths(T, ks).size() + 1; // one r per round plus 1 eta
+    uint64_t* rands = new uint64_t[cnt];
+    for(int i = 0; i < cnt; i++) {
+        rands[i] = get_rand();
+    }
+    return rands;
+}
+
+// Verifies the block proofs of an online batch of T triples from read, as
+// verifiers 0 and 2 would with the coins they gave the prover
+bool verify_online(const vector<Proof>& proofs, const TripleReader& read, uint64_t L, uint64_t T, uint64_t block, const vector<uint64_t>& ks, uint64_t sid, const vector<VerifierCoin>& coins, LagrangeCache& tables, Arena& arena, ThreadPool* pool) {
+    uint64_t k = ks[0];
+    bool ok = true;
+    for(uint64_t b = 0; b < proofs.size() && ok; b++) {
+        uint64_t size = b + 1 < proofs.size() ? block : T - b * block;
+        uint64_t copy = ((size - 1) / k + 1) * k;
+        uint64_t** input_left, **input_right, **input_mono_ss1, **input_mono_ss2;
+        shape(slice_reader(read, b * block), L, size, k, input_left, input_right, input_mono_ss1, input_mono_ss2, pool);
+        vector<uint64_t> rands(round_lengths(copy, ks).size() + 1);
+        fiat_shamir_challenges(proof_transcript(block_sid(sid, b), copy, ks, coins[b]), proofs[b], rands.data());
+        VerMsg other_vermsg = gen_vermsg(proofs[b].p_coeffs_ss1, input_left, input_mono_ss1, L, copy, ks, block_sid(sid, b), rands.data(), 1, 0, tables, arena, pool);
+        ok = verify_and_gates(proofs[b].p_coeffs_ss2, input_right, input_mono_ss2, other_vermsg, L, copy, ks, block_sid(sid, b), rands.data(), 1, 2, tables, arena, pool);
+        free_shape(k, input_left, input_right, input_mono_ss1, input_mono_ss2);
+    }
+    return ok;
+}
+
+// Rounds of one proof handed from the prover's thread to the verifiers' as
+// they are proven. publish() is the prover's on_round; wait(r) blocks until
+// round r is in. The rounds are sized up front, so a verifier can hold on to
+// ss1 or ss2 while later rounds come in.
+class RoundStream {
+public:
+    explicit RoundStream(uint64_t rounds) : ss1(rounds), ss2(rounds) {}
+
+    void publish(const Proof& proof) {
+        unique_lock<mutex> lock(mtx);
+        ss1[published] = proof.p_coeffs_ss1.back();
+        ss2[published] = proof.p_coeffs_ss2.back();
+        published++;
+        ready.notify_all();
+    }
+
+    void wait(uint64_t r) {
+        unique_lock<mutex> lock(mtx);
+        ready.wait(lock, [&] { return published > r; });
+    }
+
+    vector< vector<uint64_t> > ss1, ss2;
+
+private:
+    mutex mtx;
+    condition_variable ready;
+    uint64_t published = 0;
+};
+
+// Proves and verifies one batch with each verifier on its own thread. The
+// prover publishes every round as soon as its shares exist, and a verifier
+// replays the transcript up to round r and folds it while the prover is on
+// round r + 1, so a proof is verified shortly after its last round instead
+// of a whole verification later. arenas grows to three, one per party.
+bool prove_and_verify_pipelined(uint64_t** input_left, uint64_t** input_right, uint64_t** input_mono_ss1, uint64_t** input_mono_ss2, uint64_t var, uint64_t copy, const vector<uint64_t>& ks, uint64_t sid, const VerifierCoin& coin, LagrangeCache& tables, vector< unique_ptr<Arena> >& arenas, ThreadPool* pool, InterpolationEngine engine, Proof& proof) {
+    uint64_t rounds = round_lengths(copy, ks).size();
+    while(arenas.size() < 3) {
+        arenas.emplace_back(new Arena());
+    }
+    RoundStream stream(rounds);
+    VerMsg vermsgs[2];
+    vector< vector<uint64_t> > rands(3, vector<uint64_t>(rounds + 1));
+    auto verifier = [&](uint64_t v) {
+        verbose = false;
+        Transcript transcript = proof_transcript(sid, copy, ks, coin);
+        uint64_t* verifier_rands = rands[v + 1].data();
+        vermsgs[v] = gen_vermsg(v == 0 ? stream.ss1 : stream.ss2, v == 0 ? input_left : input_right, v == 0 ? input_mono_ss1 : input_mono_ss2, var, copy, ks, sid, verifier_rands, 1, 2 * v, tables, *arenas[v + 1], nullptr, [&](uint64_t r) {
+            if (r == 0) {
+                verifier_rands[0] = transcript.challenge_field("eta");
+                return;
+            }
+            stream.wait(r - 1);
+            transcript.append_field("p_ss1", stream.ss1[r - 1].data(), stream.ss1[r - 1].size());
+            verifier_rands[r] = share_challenge(transcript, 1, stream.ss2[r - 1]);
+        });
+    };
+    thread verifier0(verifier, 0), verifier2(verifier, 1);
+    ProverTranscript transcript(proof_transcript(sid, copy, ks, coin));
+    transcript.on_round = [&](const Proof& proof) {
+        stream.publish(proof);
+    };
+    proof = prove_and_gate(1, input_left, input_right, var, copy, ks, sid, rands[0].data(), tables, *arenas[0], pool, engine, &transcript);
+    verifier0.join();
+    verifier2.join();
+    return check_vermsgs(vermsgs[1], vermsgs[0], 1, 2);
+}
+
+// What every party of a run agrees on up front. The triples come from
+// synthetic_reader(seed) and seed is also the session id, so each party makes
+// its own inputs instead of receiving them.
+struct PartySetup {
+    uint64_t seed;
+    uint64_t T;
+    vector<uint64_t> ks;
+    ThreadPool* pool;
+    InterpolationEngine engine;
+};
+
+struct PartyResult {
+    bool verified;
+    double latency;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+};
+
+const uint64_t PROVER_ID = 1;
+
+// Runs one of the three parties of a proof over channels to the other two;
+// channels[party] is unused. Once the verifiers have tossed the coin, party 1
+// proves with a split transcript and sends each round's shares as soon as they
+// exist: the mask seed to party 0 with the first round, the second share of
+// every round to party 2. The verifiers swap their halves of every challenge
+// and fold each round as soon as it is in, while the prover works on the next
+// one. Party 0 then sends its VerMsg to party 2, which checks both and sends
+// the verdict to the others. The latency runs from the start of the proof to
+// the verdict.
+PartyResult run_party(uint64_t party, unique_ptr<Channel> channels[NUM_PARTIES], const PartySetup& setup) {
+    uint64_t L = 6;
+    uint64_t k = setup.ks[0];
+    uint64_t T = ((setup.T - 1) / k + 1) * k;
+    uint64_t sid = setup.seed;
+    vector<uint64_t> lengths = round_lengths(T, setup.ks);
+    uint64_t rounds = lengths.size();
+    vector<uint64_t> rands(rounds + 1);
+    uint64_t** input_left, **input_right, **input_mono_ss1, **input_mono_ss2;
+    shape(synthetic_reader(setup.seed), L, setup.T, k, input_left, input_right, input_mono_ss1, input_mono_ss2);
+    LagrangeCache tables;
+    Arena arena;
+    PartyResult result = {false, 0, 0, 0};
+    vector<uint8_t> message;
+
+    // The clock starts once every party has made its inputs and told the
+    // others so. The verifiers' messages carry their contributions to the
+    // coin, the prover's are empty; the byte counts leave them out.
+    bool ok = true;
+    VerifierCoin coin, contribution = draw_coin();
+    for(int i = 0; i < NUM_PARTIES; i++) {
+        if (channels[i]) {
+            channels[i]->send(party == PROVER_ID ? vector<uint8_t>() : vector<uint8_t>(contribution.bytes, contribution.bytes + COIN_BYTES));
+        }
+    }
+    if (party != PROVER_ID) {
+        coin = contribution;
+    }
+    for(int i = 0; i < NUM_PARTIES; i++) {
+        if (channels[i]) {
+            ok = channels[i]->recv(message) && message.size() == (i == PROVER_ID ? 0 : COIN_BYTES) && ok;
+            for(int b = 0; b < COIN_BYTES && ok && i != PROVER_ID; b++) {
+                coin.bytes[b] ^= message[b];
+            }
+            channels[i]->flush();
+            result.bytes_sent -= channels[i]->bytes_sent();
+            result.bytes_received -= channels[i]->bytes_received();
+        }
+    }
+    double start = wall_time();
+    if (ok && party == PROVER_ID) {
+        ProverTranscript transcript = ProverTranscript::split(sid, T, setup.ks, coin);
+        transcript.on_round = [&](const Proof& proof) {
+            if (proof.p_coeffs_ss2.size() == 1) {
+                channels[0]->send(proof.mask_seed, MASK_SEED_BYTES);
+            }
+            vector<uint8_t> share;
+            serialize_elements(proof.p_coeffs_ss2.back().data(), proof.p_coeffs_ss2.back().size(), share);
+            channels[2]->send(move(share));
+        };
+        prove_and_gate(PROVER_ID, input_left, input_right, L, T, setup.ks, sid, rands.data(), tables, arena, setup.pool, setup.engine, &transcript);
+        ok = channels[2]->recv(message) && message.size() == 1;
+        result.verified = ok && message[0] == 1;
+    }
+    else if (ok && party == 0) {
+        // The first shares are known from the seed, and with them all of
+        // this verifier's halves
+        ok = channels[PROVER_ID]->recv(message) && message.size() == MASK_SEED_BYTES;
+        vector<uint64_t> sizes(rounds), halves(rounds + 1), other;
+        for(int r = 0; r < rounds; r++) {
+            sizes[r] = 2 * round_k(setup.ks, r) - 1;
+        }
+        vector< vector<uint64_t> > shares;
+        if (ok) {
+            shares = expand_mask_shares(message.data(), sizes);
+            split_challenges(sid, T, setup.ks, coin, 0, shares, halves.data());
+            serialize_elements(halves.data(), halves.size(), message);
+            channels[2]->send(message);
+        }
+        VerMsg vermsg;
+        if (ok) {
+            vermsg = gen_vermsg(shares, input_left, input_mono_ss1, L, T, setup.ks, sid, rands.data(), PROVER_ID, 0, tables, arena, setup.pool, [&](uint64_t r) {
+                ok = ok && channels[2]->recv(message) && deserialize_elements(message.data(), message.size(), other) && other.size() == 1;
+                rands[r] = ok ? add_modp(halves[r], other[0]) : 0;
+            });
+        }
+        if (ok) {
+            serialize_vermsg(vermsg, message);
+            channels[2]->send(message);
+            ok = channels[2]->recv(message) && message.size() == 1;
+            result.verified = ok && message[0] == 1;
+        }
+    }
+    else if (ok) {
+        Transcript transcript = proof_transcript(sid, T, setup.ks, coin, SHARE_TRANSCRIPTS[1]);
+        vector< vector<uint64_t> > shares;
+        vector<uint64_t> halves, half(1);
+        // A failed round leaves zero shares behind, so the fold runs to the
+        // end and the checks fail
+        VerMsg self_vermsg = gen_vermsg(shares, input_right, input_mono_ss2, L, T, setup.ks, sid, rands.data(), PROVER_ID, 2, tables, arena, setup.pool, [&](uint64_t r) {
+            uint64_t size = r == 0 ? 0 : 2 * round_k(setup.ks, r - 1) - 1;
+            if (r > 0) {
+                shares.emplace_back(size);
+            }
+            if (!ok) {
+                return;
+            }
+            if (r == 0) {
+                half[0] = transcript.challenge_field("eta");
+                ok = channels[0]->recv(message) && deserialize_elements(message.data(), message.size(), halves) && halves.size() == rounds + 1;
+            }
+            else {
+                ok = channels[PROVER_ID]->recv(message) && deserialize_elements(message.data(), message.size(), shares.back()) && shares.back().size() == size;
+                if (!ok) {
+                    shares.back().assign(size, 0);
+                    return;
+                }
+                half[0] = share_challenge(transcript, 1, shares.back());
+            }
+            if (ok) {
+                serialize_elements(half.data(), 1, message);
+                channels[0]->send(message);
+                rands[r] = add_modp(halves[r], half[0]);
+            }
+        });
+        VerMsg other_vermsg;
+        ok = ok && channels[0]->recv(message) && deserialize_vermsg(message.data(), message.size(), other_vermsg);
+        result.verified = ok && check_vermsgs(self_vermsg, other_vermsg, PROVER_ID, 2);
+        uint8_t verdict = result.verified;
+        channels[0]->send(&verdict, 1);
+        channels[PROVER_ID]->send(&verdict, 1);
+    }
+    result.latency = wall_time() - start;
+    for(int i = 0; i < NUM_PARTIES; i++) {
+        if (channels[i]) {
+            channels[i]->flush();
+            result.bytes_sent += channels[i]->bytes_sent();
+            result.bytes_received += channels[i]->bytes_received();
+        }
+    }
+    free_shape(k, input_left, input_right, input_mono_ss1, input_mono_ss2);
+    return result;
+}
+
+bool same_proof(const Proof& a, const Proof& b) {
+    return a.p_coeffs_ss1 == b.p_coeffs_ss1 && a.p_coeffs_ss2 == b.p_coeffs_ss2 && memcmp(a.mask_seed, b.mask_seed, MASK_SEED_BYTES) == 0;
+}
+
+// A batch of T triples as the tests and benches prove it: the challenges of
+// schedule ks and the triples shaped into ks[0] rows per side, with padded
+// the count after padding. The columns are generated, adopted from the
+// caller, or left in the reader they are shaped from, in which case input is
+// null. Everything is freed with the batch.
+struct TestBatch {
+    uint64_t L, T, padded;
+    vector<uint64_t> ks;
+    uint64_t** input;
+    uint64_t* rands;
+    uint64_t** input_left, **input_right, **input_mono_ss1, **input_mono_ss2;
+    LagrangeCache tables;
+    Arena arena;
+
+    TestBatch(uint64_t L, uint64_t T, const vector<uint64_t>& ks) : TestBatch(generate_inputs(L, T), L, T, ks) {}
+
+    TestBatch(uint64_t** input, uint64_t L, uint64_t T, const vector<uint64_t>& ks) : TestBatch(memory_reader(input), L, T, ks) {
+        this->input = input;
+    }
+
+    TestBatch(const TripleReader& read, uint64_t L, uint64_t T, const vector<uint64_t>& ks)
+        : L(L), T(T), padded(((T - 1) / ks[0] + 1) * ks[0]), ks(ks), input(nullptr) {
+        rands = generate_rands(padded, ks);
+        shape(read, L, T, ks[0], input_left, input_right, input_mono_ss1, input_mono_ss2);
+    }
+
+    TestBatch(const TestBatch&) = delete;
+    TestBatch& operator=(const TestBatch&) = delete;
+    ~TestBatch() {
+        free_shape(ks[0], input_left, input_right, input_mono_ss1, input_mono_ss2);
+        delete[] rands;
+        if (input != nullptr) {
+            free_inputs(input, L);
+        }
+    }
+
+    // Party 1's proof with the mask drawn after seed_rand(1), so that proofs
+    // of the batch can be compared
+    Proof prove(ThreadPool* pool = nullptr, InterpolationEngine engine = INTERP_AUTO) {
+        seed_rand(1);
+        return prove_and_gate(1, input_left, input_right, L, padded, ks, 0, rands, tables, arena, pool, engine);
+    }
+
+    // Whether party 2 accepts proof along with party 0's VerMsg
+    bool verify(const Proof& proof, ThreadPool* pool = nullptr) {
+        VerMsg other_vermsg = gen_vermsg(proof.p_coeffs_ss1, input_left, input_mono_ss1, L, padded, ks, 0, rands, 1, 0, tables, arena, pool);
+        return verify_and_gates(proof.p_coeffs_ss2, input_right, input_mono_ss2, other_vermsg, L, padded, ks, 0, rands, 1, 2, tables, arena, pool);
+    }
+};
+
+bool test_parallel_proof() {
+    uint64_t k = 4;
+    TestBatch batch(6, 100000, {k});
+
+    Proof serial = batch.prove();
+    VerMsg serial_vermsgs[2];
+    for(int v = 0; v < 2; v++) {
+        serial_vermsgs[v] = gen_vermsg(v == 0 ? serial.p_coeffs_ss1 : serial.p_coeffs_ss2, v == 0 ? batch.input_left : batch.input_right, v == 0 ? batch.input_mono_ss1 : batch.input_mono_ss2, batch.L, batch.padded, {k}, 0, batch.rands, 1, 2 * v, batch.tables, batch.arena);
+    }
+    for(uint64_t threads = 2; threads <= 4; threads++) {
+        ThreadPool pool(threads);
+        Proof parallel = batch.prove(&pool);
+        if (!same_proof(serial, parallel)) {
+            cout << "parallel fliop() incorrect with " << threads << " threads" << endl;
+            return false;
+        }
+        // Both verifiers give the serial VerMsgs, and they still verify
+        for(int v = 0; v < 2; v++) {
+            VerMsg vermsg = gen_vermsg(v == 0 ? parallel.p_coeffs_ss1 : parallel.p_coeffs_ss2, v == 0 ? batch.input_left : batch.input_right, v == 0 ? batch.input_mono_ss1 : batch.input_mono_ss2, batch.L, batch.padded, {k}, 0, batch.rands, 1, 2 * v, batch.tables, batch.arena, &pool);
+            if (vermsg.p_eval_ksum_ss != serial_vermsgs[v].p_eval_ksum_ss || vermsg.p_eval_r_ss != serial_vermsgs[v].p_eval_r_ss
+                || vermsg.final_input != serial_vermsgs[v].final_input || vermsg.final_result_ss != serial_vermsgs[v].final_result_ss) {
+                cout << "parallel gen_vermsg() incorrect with " << threads << " threads" << endl;
+                return false;
+            }
+        }
+        if (!verify_and_gates(parallel.p_coeffs_ss2, batch.input_right, batch.input_mono_ss2, serial_vermsgs[0], batch.L, batch.padded, {k}, 0, batch.rands, 1, 2, batch.tables, batch.arena, &pool)) {
+            cout << "parallel verify_and_gates() incorrect with " << threads << " threads" << endl;
+            return false;
+        }
+    }
+    cout << "parallel fliop() and gen_vermsg() correct" << endl;
+    return true;
+}
+
+// A pinned pool must leave the caller's affinity alone, run chunk c of every
+// parallel_for() on the same worker, shape rows as the serial shape() does
+// and give the serial proof
+bool test_pinned_pool() {
+    uint64_t L = 6;
+    uint64_t T = 50001;
+    uint64_t k = 4;
+    cpu_set_t before, after;
+    sched_getaffinity(0, sizeof(before), &before);
+    bool ok;
+    {
+        ThreadPool pool(3, numa_cpus(3));
+        sched_getaffinity(0, sizeof(after), &after);
+        vector<thread::id> first(7), second(7);
+        parallel_for(&pool, 7000, 7, [&](uint64_t c, uint64_t start, uint64_t end) {
+            first[c] = this_thread::get_id();
+        });
+        parallel_for(&pool, 7000, 7, [&](uint64_t c, uint64_t start, uint64_t end) {
+            second[c] = this_thread::get_id();
+        });
+        ok = CPU_EQUAL(&before, &after) && first == second && first[0] != this_thread::get_id() && first[3] == first[0] && first[4] == first[1] && first[1] != first[2];
+
+        uint64_t** rows[2][4];
+        shape(synthetic_reader(4), L, T, k, rows[0][0], rows[0][1], rows[0][2], rows[0][3]);
+        shape(synthetic_reader(4), L, T, k, rows[1][0], rows[1][1], rows[1][2], rows[1][3], &pool);
+        uint64_t s = (T - 1) / k + 1;
+        for(int i = 0; i < k; i++) {
+            ok = ok && equal(rows[0][0][i], rows[0][0][i] + 2 * s, rows[1][0][i]) && equal(rows[0][1][i], rows[0][1][i] + 2 * s, rows[1][1][i]);
+            ok = ok && equal(rows[0][2][i], rows[0][2][i] + s, rows[1][2][i]) && equal(rows[0][3][i], rows[0][3][i] + s, rows[1][3][i]);
+        }
+        uint64_t padded = s * k;
+        uint64_t* rands = generate_rands(padded, {k});
+        LagrangeCache tables;
+        Arena arena;
+        seed_rand(1);
+        Proof expected = prove_and_gate(1, rows[0][0], rows[0][1], L, padded, {k}, 0, rands, tables, arena);
+        seed_rand(1);
+        Proof proof = prove_and_gate(1, rows[1][0], rows[1][1], L, padded, {k}, 0, rands, tables, arena, &pool);
+        ok = ok && same_proof(expected, proof);
+        for(int v = 0; v < 2; v++) {
+            free_shape(k, rows[v][0], rows[v][1], rows[v][2], rows[v][3]);
+        }
+        delete[] rands;
+    }
+    cout << (ok ? "pinned pool correct" : "pinned pool incorrect") << endl;
+    return ok;
+}
+
+// Checks every vector kernel the CPU supports against the scalar code,
+// including lengths that leave a scalar tail and values close to PR
+bool test_simd_kernels() {
+    SimdLevel detected = simd_level;
+    uint64_t n = 5000 + 13;
+    uint64_t k = 7;
+    vector<uint64_t> a(n), b(n), out(n), expected(n);
+    // Rows for k = 7 and for the kernels specialized on k up to 16, the
+    // right side of their Gram sums starting one row later
+    uint64_t* rows[17];
+    for(int i = 0; i < n; i++) {
+        a[i] = i % 17 == 0 ? PR - 1 : get_rand() % PR;
+        b[i] = i % 19 == 0 ? PR - 1 : get_rand() % PR;
+    }
+    vector< vector<uint64_t> > row_data(17, vector<uint64_t>(n));
+    vector<uint64_t> coeffs(17);
+    for(int l = 0; l < 17; l++) {
+        coeffs[l] = l == 0 ? PR - 1 : get_rand() % PR;
+        for(int j = 0; j < n; j++) {
+            row_data[l][j] = get_rand() % PR;
+        }
+        rows[l] = row_data[l].data();
+    }
+    // The eta-power kernels against one serial chain
+    uint64_t eta = b[1], first = a[2];
+    vector<uint64_t> powers(n), chain(n);
+    chain[0] = first;
+    for(int i = 1; i < n; i++) {
+        chain[i] = mul_modp(chain[i - 1], eta);
+    }
+    powers_modp_scalar(first, eta, n, powers.data());
+    if (powers != chain || powers_inner_productp_scalar(a.data(), first, eta, n) != inner_productp_scalar(a.data(), chain.data(), n)) {
+        cout << "scalar eta-power kernels incorrect" << endl;
+        return false;
+    }
+    const uint64_t sizes[4] = {n, 5, 40, 100};
+    for(int level = SIMD_SCALAR; level <= detected; level++) {
+        simd_level = (SimdLevel)level;
+        for(uint64_t fixed_k = 2; fixed_k <= 16; fixed_k *= 2) {
+            fold_modp(rows, coeffs.data(), fixed_k, 3, n - 3, out.data());
+            fold_modp_scalar(rows, coeffs.data(), fixed_k, 3, n - 3, expected.data());
+            uint64_t matrix[256], matrix_expected[256];
+            inner_product_matrixp(rows, rows + 1, fixed_k, 5, n - 5, matrix);
+            inner_product_matrixp_scalar(rows, rows + 1, fixed_k, 5, n - 5, matrix_expected);
+            if (out != expected || !equal(matrix, matrix + fixed_k * fixed_k, matrix_expected)) {
+                cout << simd_level_name(simd_level) << " kernels for k = " << fixed_k << " incorrect" << endl;
+                simd_level = detected;
+                return false;
+            }
+        }
+    }
+    for(int level = SIMD_AVX2; level <= detected; level++) {
+        simd_level = (SimdLevel)level;
+        bool ok = inner_productp(a.data(), b.data(), n) == inner_productp_scalar(a.data(), b.data(), n);
+        for(int i = 0; i < 4; i++) {
+            powers_modp(first, eta, sizes[i], powers.data());
+            ok = ok && equal(powers.begin(), powers.begin() + sizes[i], chain.begin());
+            ok = ok && powers_inner_productp(a.data(), first, eta, sizes[i]) == inner_productp_scalar(a.data(), chain.data(), sizes[i]);
+        }
+        ok = ok && batch_add_modp(a.data(), b.data(), n) == batch_add_modp_scalar(a.data(), b.data(), n);
+        ok = ok && batch_sum_modp(a.data(), n) == batch_sum_modp_scalar(a.data(), n);
+        batch_mul_modp(a.data(), b.data(), out.data(), n);
+        batch_mul_modp_scalar(a.data(), b.data(), expected.data(), n);
+        ok = ok && out == expected;
+        fold_modp(rows, coeffs.data(), k, 3, n - 3, out.data());
+        fold_modp_scalar(rows, coeffs.data(), k, 3, n - 3, expected.data());
+        ok = ok && out == expected;
+        uint64_t matrix[49], matrix_expected[49];
+        inner_product_matrixp(rows, rows, k, 5, n - 5, matrix);
+        inner_product_matrixp_scalar(rows, rows, k, 5, n - 5, matrix_expected);
+        for(int i = 0; i < k * k; i++) {
+            ok = ok && matrix[i] == matrix_expected[i] && matrix[i] == inner_productp_scalar(rows[i / k] + 5, rows[i % k] + 5, n - 5);
+        }
+        if (!ok) {
+            cout << simd_level_name(simd_level) << " kernels incorrect" << endl;
+            simd_level = detected;
+            return false;
+        }
+    }
+    simd_level = detected;
+    cout << "SIMD kernels correct" << endl;
+    return true;
+}
+
+// Times the field kernels on n elements for every supported SIMD level
+void bench_kernels(uint64_t n) {
+    SimdLevel detected = simd_level;
+    uint64_t k = 4;
+    vector<uint64_t> a(n), b(n), out(n);
+    for(int i = 0; i < n; i++) {
+        a[i] = get_rand();
+        b[i] = get_rand();
+    }
+    uint64_t* rows[4] = {a.data(), b.data(), a.data(), b.data()};
+    uint64_t coeffs[4] = {get_rand(), get_rand(), get_rand(), get_rand()};
+    uint64_t len = n / k;
+    for(int level = SIMD_SCALAR; level <= detected; level++) {
+        simd_level = (SimdLevel)level;
+        double start = wall_time();
+        uint64_t check = inner_productp(a.data(), b.data(), n);
+        double inner_time = wall_time() - start;
+        start = wall_time();
+        batch_mul_modp(a.data(), b.data(), out.data(), n);
+        double mul_time = wall_time() - start;
+        start = wall_time();
+        fold_modp(rows, coeffs, k, 0, len, out.data());
+        double fold_time = wall_time() - start;
+        start = wall_time();
+        for(int i = 0; i < k; i++) {
+            for(int j = 0; j < k; j++) {
+                check = add_modp(check, inner_productp(rows[i], rows[j], len));
+            }
+        }
+        double pairwise_time = wall_time() - start;
+        uint64_t matrix[16];
+        start = wall_time();
+        inner_product_matrixp(rows, rows, k, 0, len, matrix);
+        double matrix_time = wall_time() - start;
+        cout << simd_level_name(simd_level) << ": k*k inner_productp = " << pairwise_time << "ms, inner_product_matrixp = " << matrix_time << "ms" << endl;
+        cout << simd_level_name(simd_level) << ": inner_productp = " << inner_time << "ms, batch_mul_modp = " << mul_time
+             << "ms, fold_modp = " << fold_time << "ms (check " << check << ")" << endl;
+        // The fold for any k against the kernels specialized on k
+        for(uint64_t fold_k = 2; fold_k <= 16; fold_k *= 2) {
+            vector<uint64_t*> fold_rows(fold_k);
+            vector<uint64_t> fold_coeffs(fold_k);
+            for(int l = 0; l < fold_k; l++) {
+                fold_rows[l] = l % 2 == 0 ? a.data() : b.data();
+                fold_coeffs[l] = get_rand() % PR;
+            }
+            start = wall_time();
+            fold_modp_generic(fold_rows.data(), fold_coeffs.data(), fold_k, 0, n / fold_k, out.data());
+            double generic_time = wall_time() - start;
+            start = wall_time();
+            fold_modp(fold_rows.data(), fold_coeffs.data(), fold_k, 0, n / fold_k, out.data());
+            double fixed_time = wall_time() - start;
+            // The Gram sums of the same rows, pair by pair and specialized
+            uint64_t sums[256];
+            uint64_t gram_len = n / fold_k;
+            start = wall_time();
+            for(uint64_t t = 0; t < gram_len; t += 2048) {
+                uint64_t len = t + 2048 < gram_len ? 2048 : gram_len - t;
+                for(int i = 0; i < fold_k; i++) {
+                    for(int j = 0; j < fold_k; j++) {
+                        sums[i * fold_k + j] = inner_productp(fold_rows[i] + t, fold_rows[j] + t, len);
+                    }
+                }
+            }
+            double pairs_time = wall_time() - start;
+            start = wall_time();
+            inner_product_matrixp(fold_rows.data(), fold_rows.data(), fold_k, 0, gram_len, sums);
+            cout << simd_level_name(simd_level) << ": k = " << fold_k << " fold_modp_generic = " << generic_time << "ms, fold_modp = " << fixed_time
+                 << "ms, tiled inner_productp = " << pairs_time << "ms, inner_product_matrixp = " << wall_time() - start << "ms" << endl;
+        }
+        Prg prg(rand_key, level);
+        start = wall_time();
+        prg.fill_field(out.data(), n);
+        cout << simd_level_name(simd_level) << ": Prg::fill_field = " << wall_time() - start << "ms" << endl;
+        start = wall_time();
+        powers_modp(1, coeffs[0], n, out.data());
+        double powers_time = wall_time() - start;
+        start = wall_time();
+        check = powers_inner_productp(a.data(), 1, coeffs[0], n);
+        cout << simd_level_name(simd_level) << ": powers_modp = " << powers_time << "ms, powers_inner_productp = " << wall_time() - start << "ms (check " << check << ")" << endl;
+    }
+    simd_level = detected;
+    // The serial eta chain used before, for comparison
+    double chain_start = wall_time();
+    uint128_t chain_sum = 0;
+    uint64_t eta_power = 1;
+    for(int i = 0; i < n; i++) {
+        chain_sum += mul_modp(a[i], eta_power);
+        eta_power = mul_modp(eta_power, coeffs[0]);
+    }
+    cout << "serial eta chain = " << wall_time() - chain_start << "ms (check " << modp_128(chain_sum) << ")" << endl;
+    // The generator get_rand() used before, for comparison
+    double start = wall_time();
+    for(int i = 0; i < n; i++) {
+        out[i] = (((uint64_t)rand()) + ((uint64_t)rand() << 32)) & PR;
+    }
+    cout << "rand() pairs = " << wall_time() - start << "ms" << endl;
+}
+
+bool test_interpolation_engines() {
+    uint64_t ks[2] = {5, 8};
+    for(int t = 0; t < 2; t++) {
+        TestBatch batch(6, 20000, {ks[t]});
+        Proof gram = batch.prove(nullptr, INTERP_GRAM);
+        Proof extend = batch.prove(nullptr, INTERP_EXTEND);
+        if (!same_proof(gram, extend)) {
+            cout << "INTERP_EXTEND incorrect for k = " << ks[t] << endl;
+            return false;
+        }
+    }
+    cout << "interpolation engines correct" << endl;
+    return true;
+}
+
+// Proves and verifies with schedules that grow, shrink and mix the factors
+bool test_schedules() {
+    vector< vector<uint64_t> > schedules = {{8, 2}, {2, 8, 4}, {4, 16, 3}, {5}};
+    for(int t = 0; t < schedules.size(); t++) {
+        TestBatch batch(6, 30000, schedules[t]);
+        if (!batch.verify(batch.prove())) {
+            cout << "schedule " << schedule_name(schedules[t]) << " did not verify" << endl;
+            return false;
+        }
+    }
+    cout << "schedules correct" << endl;
+    return true;
+}
+
+// Round-trips a batch through a trace file, shapes it straight from the
+// mapping, and checks that damaged files are rejected
+bool test_trace() {
+    uint64_t L = 6;
+    uint64_t T = 10007;
+    uint64_t k = 4;
+    uint64_t** input = generate_inputs(L, T);
+    input[0][0] = PR - 1;
+    input[1][T - 1] = PR - 1;
+    TestBatch batch(input, L, T, {k});
+    char path[] = "/tmp/prover_trace_XXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+    bool ok = write_trace(path, input, L, T);
+    {
+        TraceFile trace;
+        ok = ok && trace.open(path) && trace.columns() == L && trace.size() == T;
+        vector<uint64_t> column(T);
+        for(int c = 0; c < L && ok; c++) {
+            trace.read(c, 0, T, column.data());
+            for(int i = 0; i < T; i++) {
+                ok = ok && column[i] == modp(input[c][i]);
+            }
+        }
+        TestBatch mapped_batch(trace.reader(), L, T, {k});
+        uint64_t** rows[4] = {batch.input_left, batch.input_right, batch.input_mono_ss1, batch.input_mono_ss2};
+        uint64_t** mapped[4] = {mapped_batch.input_left, mapped_batch.input_right, mapped_batch.input_mono_ss1, mapped_batch.input_mono_ss2};
+        uint64_t s = (T - 1) / k + 1;
+        for(int a = 0; a < 4 && ok; a++) {
+            uint64_t len = a < 2 ? 2 * s : s;
+            for(int i = 0; i < k; i++) {
+                for(int j = 0; j < len; j++) {
+                    ok = ok && modp(rows[a][i][j]) == mapped[a][i][j];
+                }
+            }
+        }
+    }
+    // A file with a bad magic and a truncated file must not open
+    FILE* file = fopen(path, "r+b");
+    ok = ok && file != nullptr && fwrite("X", 1, 1, file) == 1 && fclose(file) == 0;
+    TraceFile bad_magic;
+    ok = ok && !bad_magic.open(path);
+    ok = ok && write_trace(path, input, L, T) && truncate(path, sizeof(TraceHeader) + 100) == 0;
+    TraceFile truncated;
+    ok = ok && !truncated.open(path);
+    // Nor may headers whose size or column count overflow: 61 * size wraps
+    // to 1 for the inverse of 61 mod 2^64, and 2^60 columns of 2 words wrap
+    // to 0 bytes. An empty batch is refused too.
+    uint64_t inverse = TRACE_BITS;
+    for(int i = 0; i < 5; i++) {
+        inverse *= 2 - TRACE_BITS * inverse;
+    }
+    uint64_t crafted[3][2] = {{inverse, 6}, {1, 1ULL << 60}, {0, 6}};
+    for(int i = 0; i < 3 && ok; i++) {
+        TraceHeader header = {};
+        memcpy(header.magic, TRACE_MAGIC, 8);
+        header.version = TRACE_VERSION;
+        header.bits = TRACE_BITS;
+        header.size = crafted[i][0];
+        header.columns = crafted[i][1];
+        header.column_words = trace_column_words(header.size);
+        vector<uint64_t> words(12, 0);
+        file = fopen(path, "wb");
+        ok = file != nullptr && fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(words.data(), sizeof(uint64_t), words.size(), file) == words.size();
+        ok = file != nullptr && fclose(file) == 0 && ok;
+        TraceFile crafted_trace;
+        ok = ok && !crafted_trace.open(path);
+    }
+    unlink(path);
+    cout << (ok ? "trace files correct" : "trace files incorrect") << endl;
+    return ok;
+}
+
+// Streams the same triples from memory and from a trace file and checks the
+// proofs against fliop() on the shaped input
+bool test_stream_proof() {
+    uint64_t L = 6;
+    uint64_t T = 50001;
+    char path[] = "/tmp/prover_trace_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        cout << "could not create " << path << endl;
+        return false;
+    }
+    close(fd);
+    vector< vector<uint64_t> > schedules = {{4}, {8, 2}, {3, 16}};
+    bool ok = true;
+    for(int t = 0; t < schedules.size() && ok; t++) {
+        const vector<uint64_t>& ks = schedules[t];
+        TestBatch batch(L, T, ks);
+        TraceFile trace;
+        if (!write_trace(path, batch.input, L, T) || !trace.open(path)) {
+            cout << "could not write " << path << endl;
+            ok = false;
+            break;
+        }
+        ThreadPool pool(3);
+
+        Proof expected = batch.prove();
+        seed_rand(1);
+        Proof streamed = fliop_stream(memory_reader(batch.input), L, T, ks, 0, batch.rands, nullptr, batch.tables, batch.arena, nullptr, INTERP_AUTO);
+        seed_rand(1);
+        Proof from_file = fliop_stream(trace.reader(), L, T, ks, 0, batch.rands, nullptr, batch.tables, batch.arena, &pool, INTERP_AUTO);
+        if (!same_proof(expected, streamed) || !same_proof(expected, from_file)) {
+            cout << "fliop_stream() incorrect for schedule " << schedule_name(ks) << endl;
+            ok = false;
+        }
+    }
+    unlink(path);
+    if (ok) {
+        cout << "fliop_stream() correct" << endl;
+    }
+    return ok;
+}
+
+// Tiled rows must give the proof of the row layout, also when a thread's
+// slice starts inside a tile
+bool test_tiled_rows() {
+    uint64_t L = 6;
+    uint64_t T = 50001;
+    TripleReader read = synthetic_reader(9);
+    vector< vector<uint64_t> > schedules = {{4}, {8, 2}, {3, 16}};
+    bool ok = true;
+    for(int t = 0; t < schedules.size() && ok; t++) {
+        const vector<uint64_t>& ks = schedules[t];
+        TestBatch batch(read, L, T, ks);
+        ThreadPool pool(3);
+        TiledRows tiled;
+        shape_tiled(read, T, ks[0], tiled);
+
+        Proof expected = batch.prove();
+        seed_rand(1);
+        Proof serial = fliop_tiled(tiled, batch.padded, ks, batch.rands, nullptr, batch.tables, batch.arena, nullptr, INTERP_AUTO);
+        seed_rand(1);
+        Proof threaded = fliop_tiled(tiled, batch.padded, ks, batch.rands, nullptr, batch.tables, batch.arena, &pool, INTERP_AUTO);
+        if (!same_proof(expected, serial) || !same_proof(expected, threaded)) {
+            cout << "fliop_tiled() incorrect for schedule " << schedule_name(ks) << endl;
+            ok = false;
+        }
+    }
+    if (ok) {
+        cout << "tiled rows correct" << endl;
+    }
+    return ok;
+}
+
+// The packed prover must give the proof of the shaped binary input, including
+// k that takes more than one group of 8 rows, and packing must refuse field
+// elements
+bool test_bit_proof() {
+    uint64_t L = 6;
+    uint64_t T = 50001;
+    TripleReader read = binary_reader(5);
+    vector< vector<uint64_t> > schedules = {{4}, {8, 2}, {3, 16}, {12, 2}};
+    bool ok = true;
+    for(int t = 0; t < schedules.size() && ok; t++) {
+        const vector<uint64_t>& ks = schedules[t];
+        TestBatch batch(read, L, T, ks);
+        ThreadPool pool(3);
+        BitRows bits;
+        ok = pack_bits(read, T, ks[0], bits);
+
+        Proof expected = batch.prove();
+        seed_rand(1);
+        Proof packed = fliop_bits(bits, batch.padded, ks, batch.rands, nullptr, batch.tables, batch.arena, nullptr, INTERP_AUTO);
+        seed_rand(1);
+        Proof threaded = fliop_bits(bits, batch.padded, ks, batch.rands, nullptr, batch.tables, batch.arena, &pool, INTERP_AUTO);
+        ok = ok && batch.verify(packed);
+        if (!ok || !same_proof(expected, packed) || !same_proof(expected, threaded)) {
+            cout << "fliop_bits() incorrect for schedule " << schedule_name(ks) << endl;
+            ok = false;
+        }
+    }
+    BitRows bits;
+    ok = ok && !pack_bits(synthetic_reader(5), 100, 4, bits);
+    cout << (ok ? "fliop_bits() correct" : "fliop_bits() incorrect") << endl;
+    return ok;
+}
+
+// Every block proof of an online batch must verify, the last block being
+// short, and a wrong triple must be caught; appending past T and finalizing
+// before T must fail
+bool test_online_proof() {
+    uint64_t L = 6;
+    uint64_t T = 50001;
+    uint64_t block = 16384;
+    TripleReader read = synthetic_reader(11);
+    vector< vector<uint64_t> > schedules = {{4}, {8, 2}, {3, 16}, {4}};
+    bool ok = true;
+    for(int t = 0; t < schedules.size() && ok; t++) {
+        const vector<uint64_t>& ks = schedules[t];
+        bool corrupt = t + 1 == schedules.size();
+        LagrangeCache tables;
+        Arena arena;
+        vector<VerifierCoin> coins((T - 1) / block + 1);
+        vector<Proof> proofs;
+        {
+            OnlineProver online(T, block, ks, 9, [&](uint64_t b) {
+                coins[b] = draw_coin();
+                return coins[b];
+            }, tables);
+            vector<uint64_t> columns(4 * 4096);
+            for(uint64_t t0 = 0; t0 < T; t0 += 4096) {
+                uint64_t n = T - t0 < 4096 ? T - t0 : 4096;
+                for(int c = 0; c < 4; c++) {
+                    read(c, t0, n, &columns[c * 4096]);
+                }
+                if (corrupt && t0 == 20480) {
+                    columns[0] = add_modp(columns[0], 1);
+                }
+                for(uint64_t j = 0; j < n; j++) {
+                    online.append(columns[j], columns[4096 + j], columns[2 * 4096 + j], columns[3 * 4096 + j]);
+                }
+            }
+            ok = !online.append(0, 0, 0, 0) && online.finalize(proofs) && proofs.size() == coins.size();
+        }
+        bool verified = ok && verify_online(proofs, read, L, T, block, ks, 9, coins, tables, arena, nullptr);
+        if (!ok || verified == corrupt) {
+            cout << "OnlineProver incorrect for schedule " << schedule_name(ks) << (corrupt ? " with a wrong triple" : "") << endl;
+            ok = false;
+        }
+    }
+    LagrangeCache tables;
+    OnlineProver partial(10, 4, {4}, 0, [](uint64_t b) { return VerifierCoin(); }, tables);
+    vector<Proof> proofs;
+    ok = ok && partial.append(1, 2, 3, 4) && !partial.finalize(proofs);
+    cout << (ok ? "OnlineProver correct" : "OnlineProver incorrect") << endl;
+    return ok;
+}
+
+// Proving and verifying again with the same arena must reuse its blocks
+// and give the same proof
+bool test_arena() {
+    Arena small(4096);
+    uint64_t* a = small.alloc<uint64_t>(3);
+    Arena::Mark mark = small.mark();
+    uint64_t* b = small.alloc<uint64_t>(1000);
+    small.rewind(mark);
+    bool ok = (uint64_t)a % 64 == 0 && (uint64_t)b % 64 == 0 && small.alloc<uint64_t>(1) == b;
 
-    for(int i = 0; i < len; i++) {
-        p_eval_ksum = add_modp(self_vermsg.p_eval_ksum_ss[i], other_vermsg.p_eval_ksum_ss[i]);
-        p_eval_r = add_modp(self_vermsg.p_eval_r_ss[i], other_vermsg.p_eval_r_ss[i]);
-        if(p_eval_ksum != p_eval_r) {
-            cout << i << "-th sum check didn't pass" << endl;
-            return false;
+    TestBatch batch(6, 50000, {8, 2});
+    ThreadPool pool(3);
+    Proof first;
+    uint64_t capacity = 0, blocks = 0;
+    for(int run = 0; run < 3 && ok; run++) {
+        Proof proof = batch.prove(&pool);
+        ok = batch.verify(proof);
+        if (run == 0) {
+            first = proof;
+            capacity = batch.arena.capacity();
+            blocks = batch.arena.num_blocks();
+        }
+        else {
+            ok = ok && same_proof(first, proof) && batch.arena.capacity() == capacity && batch.arena.num_blocks() == blocks;
         }
     }
-    uint64_t last_input_left;
-    uint64_t last_input_right;
-    if((party_ID + 1 - prover_ID) % 3 == 0) {
-        last_input_left = self_vermsg.final_input;
-        last_input_right = other_vermsg.final_input;
+    cout << (ok ? "Arena correct" : "Arena incorrect") << endl;
+    return ok;
+}
+
+// A batch of sessions of different sizes and schedules must verify session
+// by session, and a second batch of the same sizes must fit the arenas of
+// the first. Which worker takes which session depends on scheduling, so no
+// arena may outgrow the largest arena of the first batch.
+bool test_batch_proof() {
+    uint64_t L = 6;
+    vector<uint64_t> sizes = {1000, 30001, 777, 20000, 4096, 50000};
+    vector< vector<uint64_t> > schedules = {{4}, {8, 2}, {2}, {3, 16}, {16, 4}, {8}};
+    vector<ProofSession> sessions(sizes.size());
+    vector<uint64_t**> mono_left(sizes.size()), mono_right(sizes.size());
+    for(int i = 0; i < sizes.size(); i++) {
+        ProofSession& session = sessions[i];
+        uint64_t k = schedules[i][0];
+        shape(synthetic_reader(i + 1), L, sizes[i], k, session.input_left, session.input_right, mono_left[i], mono_right[i]);
+        session.copy = ((sizes[i] - 1) / k + 1) * k;
+        session.ks = schedules[i];
+        session.sid = i;
+        session.rands = generate_rands(session.copy, session.ks);
     }
-    else {
-        last_input_left = other_vermsg.final_input;
-        last_input_right = self_vermsg.final_input;
+    LagrangeCache tables;
+    vector< unique_ptr<Arena> > arenas;
+    ThreadPool pool(3);
+    bool ok = true;
+    uint64_t capacity = 0;
+    for(int run = 0; run < 2 && ok; run++) {
+        vector<Proof> proofs = prove_batch(sessions, L, tables, arenas, &pool);
+        Arena arena;
+        for(int i = 0; i < sessions.size() && ok; i++) {
+            const ProofSession& session = sessions[i];
+            VerMsg other_vermsg = gen_vermsg(proofs[i].p_coeffs_ss1, session.input_left, mono_left[i], L, session.copy, session.ks, session.sid, session.rands, 1, 0, tables, arena);
+            ok = verify_and_gates(proofs[i].p_coeffs_ss2, session.input_right, mono_right[i], other_vermsg, L, session.copy, session.ks, session.sid, session.rands, 1, 2, tables, arena);
+        }
+        for(int w = 0; w < arenas.size(); w++) {
+            if (run == 0) {
+                capacity = max(capacity, arenas[w]->capacity());
+            }
+            else {
+                ok = ok && arenas[w]->capacity() <= capacity;
+            }
+        }
     }
-    uint64_t res = mul_modp(last_input_left, last_input_right);
-    p_eval_r = add_modp(self_vermsg.final_result_ss, other_vermsg.final_result_ss);
-    
-    if(res != p_eval_r) {
-        cout << "last check didn't pass" << endl;
-        return false;
+    for(int i = 0; i < sessions.size(); i++) {
+        free_shape(schedules[i][0], sessions[i].input_left, sessions[i].input_right, mono_left[i], mono_right[i]);
+        delete[] sessions[i].rands;
     }
-    
-    return true;
+    cout << (ok ? "prove_batch() correct" : "prove_batch() incorrect") << endl;
+    return ok;
 }
 
-void shape(
-    uint64_t** input, 
-    uint64_t L, 
-    uint64_t T, 
-    uint64_t k, 
-    uint64_t** &input_left,
-    uint64_t** &input_left_copy,
-    uint64_t** &input_right, 
-    uint64_t** &input_right_copy,
-    uint64_t** &input_mono_left,
-    uint64_t** &input_mono_right
-) {
-    uint64_t s = (T - 1) / k + 1;
+// Checks SHAKE128 against the FIPS 202 vectors, then proves with a transcript
+// and checks that the verifiers replay the prover's challenges from the proof
+// and the coin alone, and that a changed proof, session or coin changes them
+bool test_transcript() {
+    const char* messages[2] = {"", "abc"};
+    const char* digests[2] = {
+        "7f9c2ba4e88f827d616045507605853ed73b8093f6efbc88eb1a6eacfa66ef26",
+        "5881092dd818bf5cf8a3ddb793fbcba74097d5c526a6d35f97b83351940f2cc8"
+    };
+    bool ok = true;
+    for(int m = 0; m < 2; m++) {
+        uint8_t out[32];
+        char hex[65];
+        shake128((const uint8_t*)messages[m], strlen(messages[m]), out, 32);
+        for(int i = 0; i < 32; i++) {
+            snprintf(hex + 2 * i, 3, "%02x", out[i]);
+        }
+        ok = ok && strcmp(hex, digests[m]) == 0;
+    }
 
-    uint64_t* meta_left = new uint64_t[2 * s * k];
-    input_left = new uint64_t*[k];
-    input_left_copy = new uint64_t*[k];
-    for(int i = 0; i < k; i++) {
-        input_left[i] = meta_left + i * 2 * s;
-        input_left_copy[i] = new uint64_t[2 * s];
-        for(int j = 0; j < s; j++) {
-            if(i * s + j >= T) {
-                input_left[i][2 * j] = 0;
-                input_left[i][2 * j + 1] = 0;
-                input_left_copy[i][2 * j] = input_left[i][2 * j];
-                input_left_copy[i][2 * j + 1] = input_left[i][2 * j + 1];
-            }
-            else {
-                input_left[i][2 * j] = input[0][i * s + j];
-                input_left[i][2 * j + 1] = input[2][i * s + j];
-                input_left_copy[i][2 * j] = input_left[i][2 * j];
-                input_left_copy[i][2 * j + 1] = input_left[i][2 * j + 1];
-            }
+    uint64_t L = 6;
+    uint64_t T = 30000;
+    vector< vector<uint64_t> > schedules = {{4}, {8, 2}};
+    for(int t = 0; t < schedules.size() && ok; t++) {
+        const vector<uint64_t>& ks = schedules[t];
+        TestBatch batch(L, T, ks);
+        uint64_t padded = batch.padded;
+        uint64_t count = round_lengths(padded, ks).size() + 1;
+        vector<uint64_t> rands(count), streamed_rands(count), replayed(count);
+        VerifierCoin coin = draw_coin();
+
+        ProverTranscript transcript(proof_transcript(7, padded, ks, coin));
+        seed_rand(1);
+        Proof proof = prove_and_gate(1, batch.input_left, batch.input_right, L, padded, ks, 7, rands.data(), batch.tables, batch.arena, nullptr, INTERP_AUTO, &transcript);
+        ProverTranscript stream_transcript(proof_transcript(7, T, ks, coin));
+        seed_rand(1);
+        Proof streamed = fliop_stream(memory_reader(batch.input), L, T, ks, 7, streamed_rands.data(), &stream_transcript, batch.tables, batch.arena, nullptr, INTERP_AUTO);
+        fiat_shamir_challenges(proof_transcript(7, padded, ks, coin), proof, replayed.data());
+        ok = same_proof(proof, streamed) && rands == streamed_rands && rands == replayed;
+
+        VerMsg other_vermsg = gen_vermsg(proof.p_coeffs_ss1, batch.input_left, batch.input_mono_ss1, L, padded, ks, 7, replayed.data(), 1, 0, batch.tables, batch.arena);
+        ok = ok && verify_and_gates(proof.p_coeffs_ss2, batch.input_right, batch.input_mono_ss2, other_vermsg, L, padded, ks, 7, replayed.data(), 1, 2, batch.tables, batch.arena);
+
+        proof.p_coeffs_ss1[0][0] = add_modp(proof.p_coeffs_ss1[0][0], 1);
+        fiat_shamir_challenges(proof_transcript(7, padded, ks, coin), proof, replayed.data());
+        ok = ok && replayed[0] == rands[0] && replayed[1] != rands[1];
+        fiat_shamir_challenges(proof_transcript(8, padded, ks, coin), proof, replayed.data());
+        ok = ok && replayed[0] != rands[0];
+        VerifierCoin other_coin = coin;
+        other_coin.bytes[COIN_BYTES - 1] ^= 1;
+        fiat_shamir_challenges(proof_transcript(7, padded, ks, other_coin), proof, replayed.data());
+        ok = ok && replayed[0] != rands[0];
+    }
+    cout << (ok ? "Fiat-Shamir transcript correct" : "Fiat-Shamir transcript incorrect") << endl;
+    return ok;
+}
+
+// Checks ChaCha20 against the RFC 8439 block vector, the AVX2 blocks against
+// the scalar ones across a carry into the high counter word, and that
+// seed_rand() makes get_rand() repeat
+bool test_prg() {
+    uint8_t key[32];
+    for(int i = 0; i < 32; i++) {
+        key[i] = i;
+    }
+    // RFC 8439 2.3.2 uses a 32-bit counter of 1 and the nonce 00000009 0000004a 00000000
+    uint32_t state[16], block[16];
+    chacha20_init(key, 1 | (0x09000000ULL << 32), 0x4a000000, state);
+    chacha20_blocks_scalar(state, 1 | (0x09000000ULL << 32), 1, block);
+    const char* expected = "10f1e7e4d13b5915500fdd1fa32071c4c7d1f4c733c068030422aa9ac3d46c4e"
+                           "d2826446079faa0914c2d705d98b02a2b5129cd1de164eb9cbd083e8a2503c4e";
+    char hex[129];
+    for(int i = 0; i < 64; i++) {
+        snprintf(hex + 2 * i, 3, "%02x", (block[i / 4] >> (8 * (i % 4))) & 0xff);
+    }
+    bool ok = strcmp(hex, expected) == 0;
+
+    SimdLevel detected = simd_level;
+    uint64_t counter = 0xfffffffcULL;
+    vector<uint32_t> scalar(16 * 19), vectorized(16 * 19);
+    chacha20_blocks_scalar(state, counter, 19, scalar.data());
+    for(int level = SIMD_SCALAR; level <= detected; level++) {
+        simd_level = (SimdLevel)level;
+        chacha20_blocks(state, counter, 19, vectorized.data());
+        ok = ok && scalar == vectorized;
+    }
+    simd_level = detected;
+
+    vector<uint64_t> first(1000), second(1000), other(1000);
+    seed_rand(1);
+    thread_prg().fill_field(first.data(), 1000);
+    seed_rand(1);
+    for(int i = 0; i < 1000; i++) {
+        second[i] = get_rand();
+    }
+    Prg stream(rand_key, 1);
+    stream.fill_field(other.data(), 1000);
+    ok = ok && first == second && first != other;
+    for(int i = 0; i < 1000; i++) {
+        ok = ok && first[i] < PR && other[i] < PR;
+    }
+    cout << (ok ? "PRG correct" : "PRG incorrect") << endl;
+    return ok;
+}
+
+// Proofs and VerMsgs must survive the packed wire format, with the first
+// shares of a proof expanded from its seed, and still verify; damaged
+// messages must be rejected; the ark encoding must match the layout the
+// Rust prover writes and refuse words that are not field elements
+bool test_proof_encoding() {
+    TestBatch batch(6, 30000, {8, 2});
+    Proof proof = batch.prove();
+    vector<uint8_t> bytes = serialize_proof(proof);
+    Proof decoded;
+    bool ok = deserialize_proof(bytes.data(), bytes.size(), decoded) && same_proof(proof, decoded);
+    uint64_t rounds = proof.p_coeffs_ss2.size(), elements = 0;
+    for(int r = 0; r < rounds; r++) {
+        elements += proof.p_coeffs_ss2[r].size();
+    }
+    ok = ok && bytes.size() == 32 + MASK_SEED_BYTES + 8 * rounds + (elements * 61 + 7) / 8 + 8;
+    VerMsg vermsg, decoded_vermsg;
+    vector<uint8_t> vermsg_bytes;
+    if (ok) {
+        vermsg = gen_vermsg(decoded.p_coeffs_ss1, batch.input_left, batch.input_mono_ss1, batch.L, batch.padded, batch.ks, 0, batch.rands, 1, 0, batch.tables, batch.arena);
+        serialize_vermsg(vermsg, vermsg_bytes);
+        ok = deserialize_vermsg(vermsg_bytes.data(), vermsg_bytes.size(), decoded_vermsg)
+            && decoded_vermsg.p_eval_ksum_ss == vermsg.p_eval_ksum_ss && decoded_vermsg.p_eval_r_ss == vermsg.p_eval_r_ss
+            && decoded_vermsg.final_input == vermsg.final_input && decoded_vermsg.final_result_ss == vermsg.final_result_ss;
+        ok = ok && verify_and_gates(decoded.p_coeffs_ss2, batch.input_right, batch.input_mono_ss2, decoded_vermsg, batch.L, batch.padded, batch.ks, 0, batch.rands, 1, 2, batch.tables, batch.arena);
+    }
+
+    // Truncated, trailing bytes, bad magic, round sizes off, an element equal to PR
+    vector< vector<uint8_t> > damaged(5, bytes);
+    damaged[0].pop_back();
+    damaged[1].push_back(0);
+    damaged[2][0] ^= 1;
+    damaged[3][32 + MASK_SEED_BYTES] += 1;
+    memset(&damaged[4][32 + MASK_SEED_BYTES + 8 * rounds], 0xff, 8);
+    damaged.push_back(vermsg_bytes);
+    damaged.back().pop_back();
+    for(int d = 0; d < damaged.size() && ok; d++) {
+        ok = !deserialize_proof(damaged[d].data(), damaged[d].size(), decoded);
+    }
+    ok = ok && !deserialize_vermsg(bytes.data(), bytes.size(), decoded_vermsg);
+
+    // ark_serialize writes a Vec<Vec<u64>> as its length, then each inner
+    // Vec as its length and its items, all u64 little endian
+    Proof small;
+    small.p_coeffs_ss1 = {{1, 2}};
+    small.p_coeffs_ss2 = {{PR - 1}};
+    vector<uint8_t> ark;
+    serialize_proof_ark(small, ark);
+    uint64_t expected_words[7] = {1, 2, 1, 2, 1, 1, PR - 1};
+    uint8_t expected[56];
+    for(int i = 0; i < 56; i++) {
+        expected[i] = expected_words[i / 8] >> (8 * (i % 8));
+    }
+    ok = ok && ark.size() == 56 && memcmp(ark.data(), expected, 56) == 0;
+    // A word of PR is not a field element
+    uint64_t not_field = PR;
+    memcpy(&ark[48], &not_field, 8);
+    ok = ok && !deserialize_proof_ark(ark.data(), ark.size(), decoded);
+    serialize_proof_ark(proof, ark);
+    ok = ok && deserialize_proof_ark(ark.data(), ark.size(), decoded)
+        && decoded.p_coeffs_ss1 == proof.p_coeffs_ss1 && decoded.p_coeffs_ss2 == proof.p_coeffs_ss2;
+    ok = ok && !deserialize_proof_ark(ark.data(), ark.size() - 1, decoded);
+    cout << (ok ? "proof encoding correct" : "proof encoding incorrect") << endl;
+    return ok;
+}
+
+// Runs the three parties on threads over socket pairs and checks that all
+// of them see the proof verified, that every byte sent is received, that an
+// oversized message is refused, and that the halves of the verifiers add up
+// to the prover's split challenges
+bool test_parties() {
+    bool ok = true;
+    vector< vector<uint64_t> > schedules = {{4}, {8, 2}};
+    for(int t = 0; t < schedules.size() && ok; t++) {
+        PartySetup setup = {5, 30000, schedules[t], nullptr, INTERP_AUTO};
+        unique_ptr<Channel> channels[NUM_PARTIES][NUM_PARTIES];
+        ok = connect_local(channels);
+        PartyResult results[NUM_PARTIES];
+        vector<thread> parties;
+        for(int i = 0; i < NUM_PARTIES && ok; i++) {
+            parties.push_back(thread([&, i] {
+                verbose = false;
+                results[i] = run_party(i, channels[i], setup);
+            }));
         }
+        uint64_t sent = 0, received = 0;
+        for(int i = 0; i < parties.size(); i++) {
+            parties[i].join();
+            ok = ok && results[i].verified;
+            sent += results[i].bytes_sent;
+            received += results[i].bytes_received;
+        }
+        ok = ok && sent == received && sent > 0;
     }
 
-    uint64_t* meta_right = new uint64_t[2 * s * k];
-    input_right = new uint64_t*[k];
-    input_right_copy = new uint64_t*[k];
-    for(int i = 0; i < k; i++) {
-        input_right[i] = meta_right + i * 2 * s;
-        input_right_copy[i] = new uint64_t[2 * s];
-        for(int j = 0; j < s; j++) {
-            if(i * s + j >= T) {
-                input_right[i][2 * j] = 0;
-                input_right[i][2 * j + 1] = 0;
-                input_right_copy[i][2 * j] = input_right[i][2 * j];
-                input_right_copy[i][2 * j + 1] = input_right[i][2 * j + 1];
-            }
-            else {
-                input_right[i][2 * j] = input[1][i * s + j];
-                input_right[i][2 * j + 1] = input[3][i * s + j];
-                input_right_copy[i][2 * j] = input_right[i][2 * j];
-                input_right_copy[i][2 * j + 1] = input_right[i][2 * j + 1];
-            }
+    // A length prefix past the cap must be refused before anything is
+    // allocated for it
+    int fds[2];
+    ok = ok && socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0;
+    if (ok) {
+        Channel receiver(fds[1]);
+        uint8_t prefix[8] = {0, 0, 0, 0, 0, 1, 0, 0};
+        vector<uint8_t> message;
+        ok = write(fds[0], prefix, 8) == 8 && !receiver.recv(message);
+        close(fds[0]);
+    }
+
+    uint64_t L = 6;
+    uint64_t T = 30000;
+    vector<uint64_t> ks = {4};
+    uint64_t** input_left, **input_right, **input_mono_ss1, **input_mono_ss2;
+    shape(synthetic_reader(5), L, T, 4, input_left, input_right, input_mono_ss1, input_mono_ss2);
+    uint64_t count = round_lengths(T, ks).size() + 1;
+    vector<uint64_t> rands(count), halves0(count), halves1(count);
+    LagrangeCache tables;
+    Arena arena;
+    VerifierCoin coin = draw_coin();
+    ProverTranscript transcript = ProverTranscript::split(5, T, ks, coin);
+    Proof proof = prove_and_gate(1, input_left, input_right, L, T, ks, 5, rands.data(), tables, arena, nullptr, INTERP_AUTO, &transcript);
+    split_challenges(5, T, ks, coin, 0, proof.p_coeffs_ss1, halves0.data());
+    split_challenges(5, T, ks, coin, 1, proof.p_coeffs_ss2, halves1.data());
+    for(int i = 0; i < count; i++) {
+        ok = ok && add_modp(halves0[i], halves1[i]) == rands[i];
+    }
+    free_shape(4, input_left, input_right, input_mono_ss1, input_mono_ss2);
+    cout << (ok ? "party runtime correct" : "party runtime incorrect") << endl;
+    return ok;
+}
+
+// Checks that the pipelined prover and verifiers give the same proof as
+// proving first, accept it, and reject a wrong input
+bool test_pipeline() {
+    uint64_t L = 6;
+    uint64_t T = 30000;
+    bool ok = true;
+    vector< vector<uint64_t> > schedules = {{4}, {8, 2}};
+    for(int t = 0; t < schedules.size() && ok; t++) {
+        const vector<uint64_t>& ks = schedules[t];
+        uint64_t k = ks[0];
+        uint64_t** input_left, **input_right, **input_mono_ss1, **input_mono_ss2;
+        shape(synthetic_reader(3), L, T, k, input_left, input_right, input_mono_ss1, input_mono_ss2);
+        vector<uint64_t> rands(round_lengths(T, ks).size() + 1);
+        LagrangeCache tables;
+        vector< unique_ptr<Arena> > arenas;
+        arenas.emplace_back(new Arena());
+        VerifierCoin coin = draw_coin();
+        ProverTranscript transcript(proof_transcript(3, T, ks, coin));
+        seed_rand(1);
+        Proof expected = prove_and_gate(1, input_left, input_right, L, T, ks, 3, rands.data(), tables, *arenas[0], nullptr, INTERP_AUTO, &transcript);
+        Proof proof;
+        seed_rand(1);
+        ok = prove_and_verify_pipelined(input_left, input_right, input_mono_ss1, input_mono_ss2, L, T, ks, 3, coin, tables, arenas, nullptr, INTERP_AUTO, proof);
+        ok = ok && same_proof(proof, expected);
+        input_mono_ss2[0][0] = add_modp(input_mono_ss2[0][0], 1);
+        ok = ok && !prove_and_verify_pipelined(input_left, input_right, input_mono_ss1, input_mono_ss2, L, T, ks, 3, coin, tables, arenas, nullptr, INTERP_AUTO, proof);
+        free_shape(k, input_left, input_right, input_mono_ss1, input_mono_ss2);
+    }
+    cout << (ok ? "pipelined proof correct" : "pipelined proof incorrect") << endl;
+    return ok;
+}
+
+// Proves a batch of T triples for k = 2..max_k with both interpolation
+// engines and reports prover time and proof size
+void bench_k(uint64_t T, uint64_t max_k) {
+    vector<double> times[2];
+    vector<uint64_t> ks, sizes;
+    for(uint64_t k = 2; k <= max_k; k *= 2) {
+        TestBatch batch(6, T, {k});
+        Proof proofs[2];
+        for(int e = 0; e < 2; e++) {
+            double start = wall_time();
+            proofs[e] = batch.prove(nullptr, e == 0 ? INTERP_GRAM : INTERP_EXTEND);
+            times[e].push_back(wall_time() - start);
         }
+        if (!same_proof(proofs[0], proofs[1])) {
+            cout << "Engines disagree for k = " << k << endl;
+        }
+        uint64_t elements = 0;
+        for(int i = 0; i < proofs[0].p_coeffs_ss2.size(); i++) {
+            elements += proofs[0].p_coeffs_ss2[i].size();
+        }
+        ks.push_back(k);
+        sizes.push_back(elements * 8);
     }
+    cout << endl;
+    cout << "T: " << T << endl;
+    for(int i = 0; i < ks.size(); i++) {
+        cout << "k = " << ks[i] << ", Proof Share = " << sizes[i] << " bytes, gram = " << times[0][i] << "ms, extend = " << times[1][i] << "ms" << endl;
+    }
+}
 
-    uint64_t* meta_mono_left = new uint64_t[s * k];
-    input_mono_left = new uint64_t*[k];
-    for(int i = 0; i < k; i++) {
-        input_mono_left[i] = meta_mono_left + i * s;
-        for(int j = 0; j < s; j++) {
-            if(i * s + j >= T) {
-                input_mono_left[i][j] = 0;
+// Times the prover on the batch for every schedule {k0, k1} with
+// k1 <= k0 from the factors below (k0 for the first round, k1 for all later
+// ones) and returns the fastest. Each schedule keeps its best of two runs.
+vector<uint64_t> tune_schedule(const TripleReader& read, uint64_t L, uint64_t T, ThreadPool* pool, InterpolationEngine engine) {
+    const uint64_t factors[] = {2, 4, 8, 16, 32};
+    vector< vector<uint64_t> > schedules;
+    vector<double> times;
+    for(uint64_t k0 : factors) {
+        LagrangeCache tables;
+        Arena arena;
+        uint64_t** input_left, **input_right, **input_mono_ss1, **input_mono_ss2;
+        shape(read, L, T, k0, input_left, input_right, input_mono_ss1, input_mono_ss2);
+        uint64_t s = (T - 1) / k0 + 1;
+        for(uint64_t k1 : factors) {
+            if (k1 > k0) {
+                break;
             }
-            else {
-                input_mono_left[i][j] = input[4][i * s + j];
+            vector<uint64_t> ks = {k0, k1};
+            uint64_t* rands = generate_rands(s * k0, ks);
+            double best = 0;
+            for(int rep = 0; rep < 2; rep++) {
+                double start = wall_time();
+                prove_and_gate(1, input_left, input_right, L, s * k0, ks, 0, rands, tables, arena, pool, engine);
+                double elapsed = wall_time() - start;
+                best = rep == 0 || elapsed < best ? elapsed : best;
             }
+            schedules.push_back(ks);
+            times.push_back(best);
+            delete[] rands;
+        }
+        free_shape(k0, input_left, input_right, input_mono_ss1, input_mono_ss2);
+    }
+    int fastest = 0;
+    cout << endl;
+    cout << "T: " << T << endl;
+    for(int i = 0; i < schedules.size(); i++) {
+        cout << "Schedule = " << schedule_name(schedules[i]) << ", Proving Time = " << times[i] << "ms" << endl;
+        if (times[i] < times[fastest]) {
+            fastest = i;
         }
     }
+    cout << "Fastest Schedule = " << schedule_name(schedules[fastest]) << endl;
+    cout << endl;
+    return schedules[fastest];
+}
 
-    uint64_t* meta_mono_right = new uint64_t[s * k];
-    input_mono_right = new uint64_t*[k];
+// Proves the same batch with 1..max_threads threads and reports the speedup
+void bench_threads(uint64_t T, uint64_t k, uint64_t max_threads) {
+    TestBatch batch(6, T, {k});
+    vector<double> times, verify_times;
+    Proof reference;
+    for(uint64_t threads = 1; threads <= max_threads; threads++) {
+        ThreadPool pool(threads);
+        double start = wall_time();
+        Proof proof = batch.prove(&pool);
+        times.push_back(wall_time() - start);
+        if (threads == 1) {
+            reference = proof;
+        }
+        else if (!same_proof(reference, proof)) {
+            cout << "Proof with " << threads << " threads differs from the serial proof" << endl;
+        }
+        start = wall_time();
+        bool res = batch.verify(proof, &pool);
+        verify_times.push_back(wall_time() - start);
+        if (!res) {
+            cout << "Proof with " << threads << " threads does not verify" << endl;
+        }
+    }
+    cout << endl;
+    cout << "T: " << batch.padded << ", k: " << k << endl;
+    for(int i = 0; i < times.size(); i++) {
+        cout << "Threads = " << i + 1 << ", Proving Time = " << times[i] << "ms, Speedup = " << times[0] / times[i]
+             << ", Verification Time = " << verify_times[i] << "ms, Speedup = " << verify_times[0] / verify_times[i] << endl;
+    }
+}
+
+// Counts a hardware event of the calling thread through perf_event_open.
+// stop() returns -1 where the kernel or the machine does not expose it.
+class EventCounter {
+public:
+    EventCounter(uint32_t type, uint64_t config) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    ~EventCounter() {
+        if (fd >= 0) close(fd);
+    }
+
+    void start() {
+        if (fd < 0) return;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    int64_t stop() {
+        uint64_t count;
+        if (fd < 0) return -1;
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        return read(fd, &count, sizeof(count)) == sizeof(count) ? (int64_t)count : -1;
+    }
+
+private:
+    int fd;
+};
+
+string event_count(int64_t count) {
+    return count < 0 ? string("n/a") : to_string(count);
+}
+
+// Round 0 over T triples with the row layout of shape() and with tiled rows:
+// one pass that folds both sides and takes the Gram sums block by block, as
+// fliop_rows() reads its input, with its time, bandwidth and cache misses,
+// then the whole proof
+void bench_layout(uint64_t T, const vector<uint64_t>& ks, ThreadPool* pool) {
+    uint64_t L = 6;
+    uint64_t k = ks[0];
+    TripleReader read = synthetic_reader(1);
+    uint64_t** input_left, **input_right, **input_mono_ss1, **input_mono_ss2;
+    shape(read, L, T, k, input_left, input_right, input_mono_ss1, input_mono_ss2);
+    TiledRows tiled;
+    shape_tiled(read, T, k, tiled);
+    uint64_t s = tiled.s;
+    T = s * k;
+    uint64_t* rands = generate_rands(T, ks);
+    LagrangeCache tables;
+    Arena arena;
+    vector<uint64_t> coeffs(k), folded(2 * ROUND0_BLOCK), sums(k * k);
     for(int i = 0; i < k; i++) {
-        input_mono_right[i] = meta_mono_right + i * s;
-        for(int j = 0; j < s; j++) {
-            if(i * s + j >= T) {
-                input_mono_right[i][j] = 0;
+        coeffs[i] = get_rand();
+    }
+    vector<uint64_t*> left(k), right(k);
+    const char* names[2] = {"rows", "tiled"};
+    Proof reference;
+    cout << endl;
+    cout << "T: " << T << ", Schedule: " << schedule_name(ks) << endl;
+    for(int layout = LAYOUT_ROWS; layout <= LAYOUT_TILED; layout++) {
+        EventCounter llc_misses(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+        EventCounter l1_misses(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+        llc_misses.start();
+        l1_misses.start();
+        double start = wall_time();
+        uint64_t check = 0;
+        for(uint64_t j0 = 0; j0 < s; j0 += ROUND0_BLOCK) {
+            uint64_t len = j0 + ROUND0_BLOCK < s ? ROUND0_BLOCK : s - j0;
+            for(int i = 0; i < k; i++) {
+                left[i] = layout == LAYOUT_ROWS ? input_left[i] + 2 * j0 : tiled.row(0, i, j0 / ROUND0_BLOCK);
+                right[i] = layout == LAYOUT_ROWS ? input_right[i] + 2 * j0 : tiled.row(1, i, j0 / ROUND0_BLOCK);
             }
-            else {
-                input_mono_right[i][j] = input[5][i * s + j];
+            fold_modp(left.data(), coeffs.data(), k, 0, 2 * len, folded.data());
+            fold_modp(right.data(), coeffs.data(), k, 0, 2 * len, folded.data());
+            inner_product_matrixp(left.data(), right.data(), k, 0, 2 * len, sums.data());
+            check = add_modp(check, add_modp(folded[0], sums[0]));
+        }
+        double pass_time = wall_time() - start;
+        int64_t llc = llc_misses.stop(), l1 = l1_misses.stop();
+
+        seed_rand(1);
+        start = wall_time();
+        Proof proof = layout == LAYOUT_ROWS ?
+            fliop(input_left, input_right, L, T, ks, 0, rands, nullptr, tables, arena, pool, INTERP_AUTO) :
+            fliop_tiled(tiled, T, ks, rands, nullptr, tables, arena, pool, INTERP_AUTO);
+        double prove_time = wall_time() - start;
+        if (layout == LAYOUT_ROWS) {
+            reference = proof;
+        }
+        else if (!same_proof(reference, proof)) {
+            cout << "Proof from tiled rows differs" << endl;
+        }
+        double bytes = 4.0 * k * s * sizeof(uint64_t);
+        cout << "Layout = " << names[layout] << ": Round-0 Pass = " << pass_time << "ms (" << bytes / pass_time / 1e6 << " GB/s, check " << check
+             << "), LLC Misses = " << event_count(llc) << ", L1D Read Misses = " << event_count(l1) << ", Proving Time = " << prove_time << "ms" << endl;
+    }
+    free_shape(k, input_left, input_right, input_mono_ss1, input_mono_ss2);
+    delete[] rands;
+}
+
+// Proofs per second for many small sessions of T triples each: proven one
+// by one with fresh tables and arena each, as separate prove_and_gate() calls
+// do, and with prove_batch() on the pool
+void bench_batch(uint64_t max_threads, const vector<uint64_t>& ks) {
+    uint64_t L = 6;
+    uint64_t k = ks[0];
+    const uint64_t total = 2000000;
+    vector<uint64_t> sizes = {1000, 10000, 100000};
+    ThreadPool pool(max_threads);
+    cout << endl;
+    for(int t = 0; t < sizes.size(); t++) {
+        uint64_t T = ((sizes[t] - 1) / k + 1) * k;
+        uint64_t count = total / T;
+        vector<ProofSession> sessions(count);
+        vector<uint64_t**> mono_left(count), mono_right(count);
+        for(int i = 0; i < count; i++) {
+            shape(synthetic_reader(i + 1), L, T, k, sessions[i].input_left, sessions[i].input_right, mono_left[i], mono_right[i]);
+            sessions[i].copy = T;
+            sessions[i].ks = ks;
+            sessions[i].sid = i;
+            sessions[i].rands = generate_rands(T, ks);
+        }
+
+        verbose = false;
+        double start = wall_time();
+        for(int i = 0; i < count; i++) {
+            LagrangeCache tables;
+            Arena arena;
+            prove_and_gate(1, sessions[i].input_left, sessions[i].input_right, L, T, ks, i, sessions[i].rands, tables, arena);
+        }
+        double single_time = wall_time() - start;
+        verbose = true;
+
+        LagrangeCache tables;
+        vector< unique_ptr<Arena> > arenas;
+        prove_batch(sessions, L, tables, arenas, &pool);
+        start = wall_time();
+        prove_batch(sessions, L, tables, arenas, &pool);
+        double batch_time = wall_time() - start;
+
+        cout << "T = " << T << ", Sessions = " << count << ", One by One = " << count * 1000 / single_time
+             << " proofs/s, Batch (" << pool.size() << " threads) = " << count * 1000 / batch_time << " proofs/s" << endl;
+        for(int i = 0; i < count; i++) {
+            free_shape(k, sessions[i].input_left, sessions[i].input_right, mono_left[i], mono_right[i]);
+            delete[] sessions[i].rands;
+        }
+    }
+}
+
+// Encode and decode throughput of the wire formats on proofs of the given
+// number of rounds of 2k - 1 coefficients each, in proofs per second and
+// MB/s of field elements (8 bytes each)
+void bench_wire(uint64_t k, uint64_t rounds, uint64_t iterations) {
+    Proof proof;
+    for(int i = 0; i < MASK_SEED_BYTES; i++) {
+        proof.mask_seed[i] = i;
+    }
+    vector<uint64_t> sizes(rounds, 2 * k - 1);
+    proof.p_coeffs_ss1 = expand_mask_shares(proof.mask_seed, sizes);
+    proof.p_coeffs_ss2 = expand_mask_shares(proof.mask_seed, sizes);
+    double megabytes = rounds * (2 * k - 1) * 8 * (double)iterations / 1048576.0;
+    vector<uint8_t> bytes, ark;
+    vector<uint64_t> share(2 * k - 1);
+    Proof decoded;
+    uint64_t check = 0;
+
+    double start = wall_time();
+    for(int it = 0; it < iterations; it++) {
+        serialize_proof(proof, bytes);
+    }
+    double encode_time = wall_time() - start;
+    start = wall_time();
+    for(int it = 0; it < iterations; it++) {
+        ProofView view;
+        view.parse(bytes.data(), bytes.size());
+        for(int r = 0; r < rounds; r++) {
+            view.round(r, share.data());
+            check += share[0];
+        }
+    }
+    double view_time = wall_time() - start;
+    start = wall_time();
+    for(int it = 0; it < iterations; it++) {
+        deserialize_proof(bytes.data(), bytes.size(), decoded);
+    }
+    double decode_time = wall_time() - start;
+    start = wall_time();
+    for(int it = 0; it < iterations; it++) {
+        serialize_proof_ark(proof, ark);
+    }
+    double ark_encode_time = wall_time() - start;
+    start = wall_time();
+    for(int it = 0; it < iterations; it++) {
+        deserialize_proof_ark(ark.data(), ark.size(), decoded);
+    }
+    double ark_decode_time = wall_time() - start;
+
+    cout << "k = " << k << ", Rounds = " << rounds << ", Packed = " << bytes.size() << " bytes, ark = " << ark.size() << " bytes (check " << check % 10 << ")" << endl;
+    double times[5] = {encode_time, view_time, decode_time, ark_encode_time, ark_decode_time};
+    const char* names[5] = {"serialize_proof", "ProofView", "deserialize_proof (expands ss1)", "serialize_proof_ark", "deserialize_proof_ark"};
+    for(int i = 0; i < 5; i++) {
+        cout << names[i] << " = " << iterations * 1000 / times[i] << " proofs/s, " << megabytes * 1000 / times[i] << " MB/s" << endl;
+    }
+}
+
+// One party of a proof as its own process, connected to the other two over
+// TCP on localhost from base_port on
+int party_process(uint64_t party, PartySetup setup, uint64_t base_port, uint64_t threads) {
+    if (party >= NUM_PARTIES) {
+        cout<<"--party must be 0, 1 or 2"<<endl;
+        return 1;
+    }
+    unique_ptr<Channel> channels[NUM_PARTIES];
+    if (!connect_parties(party, base_port, channels)) {
+        return 1;
+    }
+    ThreadPool pool(threads);
+    setup.pool = &pool;
+    verbose = false;
+    PartyResult result = run_party(party, channels, setup);
+    cout<<"Party "<<party<<": Verified = "<<result.verified<<", Latency = "<<result.latency<<"ms, Sent = "<<result.bytes_sent<<" bytes, Received = "<<result.bytes_received<<" bytes"<<endl;
+    return result.verified ? 0 : 1;
+}
+
+// Forks the three parties of a proof and waits for them
+int launch_parties(const PartySetup& setup, uint64_t base_port, uint64_t threads) {
+    cout.flush();
+    vector<pid_t> children;
+    for(uint64_t party = 0; party < NUM_PARTIES; party++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            int status = seed_rand() ? party_process(party, setup, base_port, threads) : 1;
+            cout.flush();
+            _exit(status);
+        }
+        if (pid < 0) {
+            cout<<"Cannot start party "<<party<<endl;
+            return 1;
+        }
+        children.push_back(pid);
+    }
+    bool ok = true;
+    for(int i = 0; i < children.size(); i++) {
+        int status;
+        ok = waitpid(children[i], &status, 0) == children[i] && WIFEXITED(status) && WEXITSTATUS(status) == 0 && ok;
+    }
+    cout<<"T: "<<setup.T<<endl;
+    cout<<"Schedule: "<<schedule_name(setup.ks)<<endl;
+    cout<<"Verified = "<<ok<<endl;
+    return ok ? 0 : 1;
+}
+
+// Returns the value following flag on the command line, or fallback if absent
+uint64_t arg_value(int argc, char** argv, const char* flag, uint64_t fallback) {
+    for(int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], flag) == 0) {
+            return strtoull(argv[i + 1], nullptr, 10);
+        }
+    }
+    return fallback;
+}
+
+// Returns the string following flag on the command line, or nullptr
+const char* arg_string(int argc, char** argv, const char* flag) {
+    for(int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], flag) == 0) {
+            return argv[i + 1];
+        }
+    }
+    return nullptr;
+}
+
+bool has_arg(int argc, char** argv, const char* flag) {
+    for(int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], flag) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Parses a comma separated schedule such as 16,4,2 following flag, or
+// returns {fallback} if flag is absent
+vector<uint64_t> arg_schedule(int argc, char** argv, const char* flag, uint64_t fallback) {
+    vector<uint64_t> ks;
+    for(int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], flag) == 0) {
+            char* p = argv[i + 1];
+            while(*p != '\0') {
+                ks.push_back(strtoull(p, &p, 10));
+                if (*p != ',') {
+                    break;
+                }
+                p++;
             }
         }
     }
+    if (ks.empty()) {
+        ks.push_back(fallback);
+    }
+    return ks;
 }
 
-int main() {
-    uint64_t T = 10000000;
+int main(int argc, char** argv) {
+    uint64_t T = arg_value(argc, argv, "--T", 10000000);
     uint64_t L = 6;
-    uint64_t k = 4;
+    vector<uint64_t> ks = arg_schedule(argc, argv, "--ks", arg_value(argc, argv, "--k", 4));
+    // Every mode, the benchmarks included, takes this schedule
+    for(int i = 0; i < ks.size(); i++) {
+        if (ks[i] < 2) {
+            cout<<"Every k in the schedule must be at least 2"<<endl;
+            return 1;
+        }
+    }
+    uint64_t k = ks[0];
+    uint64_t threads = arg_value(argc, argv, "--threads", 1);
+    InterpolationEngine engine = (InterpolationEngine)arg_value(argc, argv, "--interp", INTERP_AUTO);
     uint64_t _party_id = 1;
-    srand((unsigned)time(NULL));
+    if (!seed_rand()) {
+        return 1;
+    }
+
+    uint64_t level = arg_value(argc, argv, "--simd", simd_level);
+    if (level < simd_level) {
+        simd_level = (SimdLevel)level;
+    }
+    cout<<"SIMD: "<<simd_level_name(simd_level)<<endl;
+
+    if (has_arg(argc, argv, "--test")) {
+        bool ok = test_lagrange_table();
+        ok = test_simd_kernels() && ok;
+        ok = test_parallel_proof() && ok;
+        ok = test_pinned_pool() && ok;
+        ok = test_interpolation_engines() && ok;
+        ok = test_schedules() && ok;
+        ok = test_trace() && ok;
+        ok = test_stream_proof() && ok;
+        ok = test_tiled_rows() && ok;
+        ok = test_bit_proof() && ok;
+        ok = test_online_proof() && ok;
+        ok = test_arena() && ok;
+        ok = test_batch_proof() && ok;
+        ok = test_transcript() && ok;
+        ok = test_prg() && ok;
+        ok = test_proof_encoding() && ok;
+        ok = test_parties() && ok;
+        ok = test_pipeline() && ok;
+        return ok ? 0 : 1;
+    }
+    if (has_arg(argc, argv, "--bench-kernels")) {
+        bench_kernels(arg_value(argc, argv, "--bench-kernels", 10000000));
+        return 0;
+    }
+    if (has_arg(argc, argv, "--bench-k")) {
+        bench_k(arg_value(argc, argv, "--T", 1000000), arg_value(argc, argv, "--bench-k", 64));
+        return 0;
+    }
+    if (has_arg(argc, argv, "--bench-batch")) {
+        bench_batch(arg_value(argc, argv, "--bench-batch", thread::hardware_concurrency()), ks);
+        return 0;
+    }
+    if (has_arg(argc, argv, "--bench-wire")) {
+        bench_wire(k, 20, arg_value(argc, argv, "--bench-wire", 100000));
+        return 0;
+    }
+    if (has_arg(argc, argv, "--bench-layout")) {
+        ThreadPool pool(threads);
+        bench_layout(T, ks, &pool);
+        return 0;
+    }
+    if (has_arg(argc, argv, "--bench-threads")) {
+        bench_threads(T, k, arg_value(argc, argv, "--bench-threads", thread::hardware_concurrency()));
+        return 0;
+    }
+
+    // --party runs one party against two other processes on localhost and
+    // --parties starts all three; they share the --seed of the inputs
+    if (has_arg(argc, argv, "--party") || has_arg(argc, argv, "--parties")) {
+        PartySetup setup = {arg_value(argc, argv, "--seed", 1), T, ks, nullptr, engine};
+        uint64_t port = arg_value(argc, argv, "--port", 47000);
+        if (has_arg(argc, argv, "--parties")) {
+            return launch_parties(setup, port, threads);
+        }
+        return party_process(arg_value(argc, argv, "--party", NUM_PARTIES), setup, port, threads);
+    }
+
+    // --numa pins the pool's threads and splits them over the NUMA nodes in
+    // order; the shaped rows are then first touched by the threads that fold
+    // them
     uint64_t sid = get_rand();
+    ThreadPool pool(threads, has_arg(argc, argv, "--numa") ? numa_cpus(threads) : vector<int>());
+    double start, end;
 
-    uint64_t cnt = log(2 * T)/log(k) + 1 + 2; // log_k 2T + 2 rounds plus 1 eta
-    //cout<<"Total Randomness : "<<cnt<<endl;
-    uint64_t* rands = new uint64_t[cnt];
-    for(int i = 0; i < cnt; i++) {
-        rands[i] = get_rand();
+    if (arg_string(argc, argv, "--dump") != nullptr) {
+        const char* path = arg_string(argc, argv, "--dump");
+        uint64_t** input = generate_inputs(L, T);
+        bool ok = write_trace(path, input, L, T);
+        cout<<(ok ? "Wrote " : "Could not write ")<<path<<endl;
+        return ok ? 0 : 1;
     }
 
-    // Generate satisfying inputs
-    uint64_t** input = new uint64_t*[L];
-    for(int i = 0; i < L - 1; i++) {
-        input[i] = new uint64_t[T];
-        for(int j = 0; j < T; j++) {
-            input[i][j] = get_rand();
+    // Inputs come from a trace written by --dump when one is given
+    const char* trace_path = arg_string(argc, argv, "--trace");
+    TraceFile trace;
+    if (trace_path != nullptr) {
+        if (!trace.open(trace_path)) {
+            return 1;
         }
+        if (trace.columns() != L) {
+            cout<<trace_path<<" has "<<trace.columns()<<" columns instead of "<<L<<endl;
+            return 1;
+        }
+        T = trace.size();
     }
-    input[L - 1] = new uint64_t[T];
-    for(int j = 0; j < T; j++) {
-        uint128_t temp_res = (uint128_t)input[0][j] * (uint128_t)input[1][j] + (uint128_t)input[2][j] * (uint128_t)input[3][j];   
-        input[L - 1][j] = modp_128(temp_res);
-        if (input[L-1][j] > input[L-2][j]) {
-            input[L-1][j] = input[L-1][j] - input[L-2][j];
+
+    // The prover draws the challenges from a Fiat-Shamir transcript, and the
+    // verifiers replay it from the proof, unless --interactive asks for
+    // challenges drawn up front. Each mode tosses the verifiers' coin of the
+    // transcript only once its triples are fixed.
+    bool interactive = has_arg(argc, argv, "--interactive");
+
+    if (has_arg(argc, argv, "--stream")) {
+        TripleReader read = trace_path == nullptr ? synthetic_reader(sid) : trace.reader();
+        uint64_t* rands = generate_rands(T, ks);
+        vector<uint64_t> lengths = round_lengths(T, ks);
+        LagrangeCache tables;
+        Arena arena;
+        VerifierCoin coin = draw_coin();
+        ProverTranscript transcript(proof_transcript(sid, T, ks, coin));
+        start = wall_time();
+        Proof proof = fliop_stream(read, L, T, ks, sid, rands, interactive ? nullptr : &transcript, tables, arena, &pool, engine);
+        end = wall_time();
+        cout<<endl;
+        cout<<"T: "<<T<<endl;
+        cout<<"Schedule: "<<schedule_name(ks)<<endl;
+        cout<<"Resident Folded Input = "<<2 * round_k(ks, 1) * lengths[1] * sizeof(uint64_t) / 1048576.0<<"MB"<<endl;
+        cout<<"Total Proving Time = "<<end-start<<"ms"<<endl;
+        return 0;
+    }
+
+    // --bits proves binary triples from bit-packed rows; the verifiers still
+    // hold their rows as field elements
+    if (has_arg(argc, argv, "--bits")) {
+        TripleReader read = trace_path == nullptr ? binary_reader(sid) : trace.reader();
+        BitRows bits;
+        if (!pack_bits(read, T, k, bits)) {
+            return 1;
         }
-        else {
-            input[L-1][j] = PR - input[L-2][j] +input[L-1][j];
+        uint64_t padded = ((T - 1) / k + 1) * k;
+        uint64_t* rands = generate_rands(padded, ks);
+        LagrangeCache tables;
+        Arena arena;
+        VerifierCoin coin = draw_coin();
+        ProverTranscript transcript(proof_transcript(sid, padded, ks, coin));
+        start = wall_time();
+        Proof proof = fliop_bits(bits, padded, ks, rands, interactive ? nullptr : &transcript, tables, arena, &pool, engine);
+        end = wall_time();
+        cout<<endl;
+        cout<<"T: "<<T<<endl;
+        cout<<"Schedule: "<<schedule_name(ks)<<endl;
+        cout<<"Packed Input = "<<bits.data.size() * sizeof(uint64_t) / 1048576.0<<"MB (shaped: "<<4 * padded * sizeof(uint64_t) / 1048576.0<<"MB)"<<endl;
+        cout<<"Total Proving Time = "<<end-start<<"ms"<<endl;
+
+        uint64_t** input_left, **input_right, **input_mono_ss1, **input_mono_ss2;
+        shape(read, L, T, k, input_left, input_right, input_mono_ss1, input_mono_ss2, &pool);
+        if (!interactive) {
+            fiat_shamir_challenges(proof_transcript(sid, padded, ks, coin), proof, rands);
+        }
+        VerMsg other_vermsg = gen_vermsg(proof.p_coeffs_ss1, input_left, input_mono_ss1, L, padded, ks, sid, rands, 1, 0, tables, arena, &pool);
+        bool res = verify_and_gates(proof.p_coeffs_ss2, input_right, input_mono_ss2, other_vermsg, L, padded, ks, sid, rands, 1, 2, tables, arena, &pool);
+        cout<<"Verified = "<<res<<endl;
+        return 0;
+    }
+
+    // --online appends the triples to the prover as they are read, as an
+    // MPC engine would while it evaluates the gates, and proves every block
+    // of --block triples while the next one fills
+    if (has_arg(argc, argv, "--online")) {
+        TripleReader read = trace_path == nullptr ? synthetic_reader(sid) : trace.reader();
+        uint64_t block = arg_value(argc, argv, "--block", 1 << 20);
+        if (block == 0) {
+            cout<<"--block must be at least 1"<<endl;
+            return 1;
+        }
+        LagrangeCache tables;
+        Arena arena;
+        vector<VerifierCoin> coins((T - 1) / block + 1);
+        vector<Proof> proofs;
+        double append_time = 0;
+        {
+            OnlineProver online(T, block, ks, sid, [&](uint64_t b) {
+                coins[b] = draw_coin();
+                return coins[b];
+            }, tables, engine);
+            const uint64_t chunk = 4096;
+            vector<uint64_t> columns(4 * chunk);
+            for(uint64_t t0 = 0; t0 < T; t0 += chunk) {
+                uint64_t n = T - t0 < chunk ? T - t0 : chunk;
+                for(int c = 0; c < 4; c++) {
+                    read(c, t0, n, &columns[c * chunk]);
+                }
+                start = wall_time();
+                for(uint64_t j = 0; j < n; j++) {
+                    online.append(columns[j], columns[chunk + j], columns[2 * chunk + j], columns[3 * chunk + j]);
+                }
+                append_time += wall_time() - start;
+            }
+            start = wall_time();
+            if (!online.finalize(proofs)) {
+                return 1;
+            }
+            end = wall_time();
+        }
+        uint64_t encoded = 0;
+        for(int b = 0; b < proofs.size(); b++) {
+            encoded += serialize_proof(proofs[b]).size();
         }
+        cout<<endl;
+        cout<<"T: "<<T<<endl;
+        cout<<"Schedule: "<<schedule_name(ks)<<endl;
+        cout<<"Blocks: "<<proofs.size()<<" of "<<block<<" triples"<<endl;
+        cout<<"Append Time = "<<append_time<<"ms ("<<append_time * 1e6 / T<<"ns per triple)"<<endl;
+        cout<<"Finalize Time = "<<end-start<<"ms"<<endl;
+        cout<<"Encoded Proofs = "<<encoded<<" bytes"<<endl;
+        bool res = verify_online(proofs, read, L, T, block, ks, sid, coins, tables, arena, &pool);
+        cout<<"Verified = "<<res<<endl;
+        return 0;
+    }
+
+    // Generate satisfying inputs
+    uint64_t** input = nullptr;
+    if (trace_path == nullptr) {
+        input = generate_inputs(L, T);
+    }
+    TripleReader read = input != nullptr ? memory_reader(input) : trace.reader();
+
+    if (has_arg(argc, argv, "--tune")) {
+        ks = tune_schedule(read, L, T, &pool, engine);
+        k = ks[0];
     }
+    uint64_t* rands = generate_rands(T, ks);
 
-    uint64_t** input_left, **input_right, **input_mono_ss1, **input_mono_ss2, **input_left_copy, **input_right_copy;
+    uint64_t** input_left, **input_right, **input_mono_ss1, **input_mono_ss2;
 
-    shape(input, L, T, k, input_left, input_left_copy, input_right, input_right_copy, input_mono_ss1, input_mono_ss2);
+    shape(read, L, T, k, input_left, input_right, input_mono_ss1, input_mono_ss2, &pool);
+    // --layout 1 gives the prover its own copy of the rows in tiles
+    RowLayout layout = (RowLayout)arg_value(argc, argv, "--layout", LAYOUT_ROWS);
+    TiledRows tiled;
+    if (layout == LAYOUT_TILED) {
+        shape_tiled(read, T, k, tiled);
+    }
+    // Proving and verifying only read the shaped rows
+    if (input != nullptr) {
+        free_inputs(input, L);
+    }
 
     cout<<"T: "<<T<<endl;
+    cout<<"Schedule: "<<schedule_name(ks)<<endl;
     T = ((T - 1) / k + 1) * k; // Update T to include padding triples
-    clock_t start, end;
+    LagrangeCache tables;
+    VerifierCoin coin = draw_coin();
+
+    // The verifiers run on their own threads and fold each round as soon as
+    // the prover has it
+    if (has_arg(argc, argv, "--pipeline")) {
+        vector< unique_ptr<Arena> > arenas;
+        Proof proof;
+        start = wall_time();
+        bool res = prove_and_verify_pipelined(input_left, input_right, input_mono_ss1, input_mono_ss2, L, T, ks, sid, coin, tables, arenas, &pool, engine, proof);
+        end = wall_time();
+        cout<<"Total Proving + Verification Time = "<<end-start<<"ms"<<endl;
+        cout<<"Verified = "<<res<<endl;
+        return 0;
+    }
+
+    Arena arena;
+    ProverTranscript transcript(proof_transcript(sid, T, ks, coin));
 
-    start = clock();
-    Proof proof = prove_and_gate(_party_id, input_left, input_right, L, T, k, sid, rands);
-    end = clock();
-    cout<<"Total Proving Time = "<<double(end-start)/CLOCKS_PER_SEC * 1000<<"ms"<<endl;
+    start = wall_time();
+    Proof proof = layout == LAYOUT_TILED ?
+        fliop_tiled(tiled, T, ks, rands, interactive ? nullptr : &transcript, tables, arena, &pool, engine) :
+        prove_and_gate(_party_id, input_left, input_right, L, T, ks, sid, rands, tables, arena, &pool, engine, interactive ? nullptr : &transcript);
+    end = wall_time();
+    cout<<"Total Proving Time = "<<end-start<<"ms"<<endl;
     cout<<endl;
 
-    start = clock();
-    VerMsg other_vermsg = gen_vermsg(proof.p_coeffs_ss1, input_left_copy, input_mono_ss1, L, T, k, sid, rands, 1, 0);
-    bool res = verify_and_gates(proof.p_coeffs_ss2, input_right_copy, input_mono_ss2, other_vermsg, L, T, k, sid, rands, 1, 2);
-    end = clock();
-    cout<<"Total Verification Time = "<<double(end-start)/CLOCKS_PER_SEC * 1000<<"ms"<<endl;
+    // The verifiers work from the encoded proof, which carries the seed of
+    // the first shares instead of the shares
+    vector<uint8_t> encoded = serialize_proof(proof);
+    cout<<"Encoded Proof = "<<encoded.size()<<" bytes"<<endl;
+    start = wall_time();
+    if (!deserialize_proof(encoded.data(), encoded.size(), proof)) {
+        return 1;
+    }
+    uint64_t* verifier_rands = rands;
+    if (!interactive) {
+        verifier_rands = new uint64_t[round_lengths(T, ks).size() + 1];
+        fiat_shamir_challenges(proof_transcript(sid, T, ks, coin), proof, verifier_rands);
+    }
+    VerMsg other_vermsg = gen_vermsg(proof.p_coeffs_ss1, input_left, input_mono_ss1, L, T, ks, sid, verifier_rands, 1, 0, tables, arena, &pool);
+    vector<uint8_t> encoded_vermsg;
+    serialize_vermsg(other_vermsg, encoded_vermsg);
+    if (!deserialize_vermsg(encoded_vermsg.data(), encoded_vermsg.size(), other_vermsg)) {
+        return 1;
+    }
+    bool res = verify_and_gates(proof.p_coeffs_ss2, input_right, input_mono_ss2, other_vermsg, L, T, ks, sid, verifier_rands, 1, 2, tables, arena, &pool);
+    end = wall_time();
+    cout<<"Total Verification Time = "<<end-start<<"ms"<<endl;
+    cout<<"Encoded VerMsg = "<<encoded_vermsg.size()<<" bytes"<<endl;
     cout<<"Verified = "<<res<<endl;
 
     return 0;
 }
-
@@ -0,0 +1,77 @@
+#pragma once
+#include "arithmetic.h"
+#include <cstring>
+#include <functional>
+
+using namespace std;
+
+// Random access to the L input columns of a batch of triples: read(column,
+// start, count, out) copies entries [start, start + count) of the column into
+// out. The streaming prover calls it from several threads at once.
+typedef function<void(uint64_t, uint64_t, uint64_t, uint64_t*)> TripleReader;
+
+// Reader over columns held in memory, as generate_inputs() returns them
+TripleReader memory_reader(uint64_t** input) {
+    return [input](uint64_t column, uint64_t start, uint64_t count, uint64_t* out) {
+        memcpy(out, input[column] + start, count * sizeof(uint64_t));
+    };
+}
+
+uint64_t splitmix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Reader that derives every triple from its index, so batches of any size can
+// be streamed without being stored: columns 0..4 of triple t are hashes of
+// (seed, t) and column 5 completes input[4] + input[5] = input[0] * input[1] +
+// input[2] * input[3]
+TripleReader synthetic_reader(uint64_t seed) {
+    return [seed](uint64_t column, uint64_t start, uint64_t count, uint64_t* out) {
+        for(uint64_t t = start; t < start + count; t++) {
+            if (column < 5) {
+                out[t - start] = modp(splitmix64(seed ^ (t * 6 + column)) >> 3);
+                continue;
+            }
+            uint64_t x[5];
+            for(int c = 0; c < 5; c++) {
+                x[c] = modp(splitmix64(seed ^ (t * 6 + c)) >> 3);
+            }
+            uint128_t temp_res = (uint128_t)x[0] * x[1] + (uint128_t)x[2] * x[3];
+            out[t - start] = sub_modp(modp_128(temp_res), x[4]);
+        }
+    };
+}
+
+// Reader of binary triples derived from their index like synthetic_reader():
+// columns 0..3 of triple t are bits, column 4 is a field element and column 5
+// completes input[4] + input[5] = input[0] * input[1] + input[2] * input[3]
+TripleReader binary_reader(uint64_t seed) {
+    return [seed](uint64_t column, uint64_t start, uint64_t count, uint64_t* out) {
+        for(uint64_t t = start; t < start + count; t++) {
+            if (column < 4) {
+                out[t - start] = splitmix64(seed ^ (t * 6 + column)) >> 63;
+                continue;
+            }
+            uint64_t x4 = modp(splitmix64(seed ^ (t * 6 + 4)) >> 3);
+            if (column == 4) {
+                out[t - start] = x4;
+                continue;
+            }
+            uint64_t x[4];
+            for(int c = 0; c < 4; c++) {
+                x[c] = splitmix64(seed ^ (t * 6 + c)) >> 63;
+            }
+            out[t - start] = sub_modp(x[0] * x[1] + x[2] * x[3], x4);
+        }
+    };
+}
+
+// Reader of the triples from first on of read, as a batch of their own
+TripleReader slice_reader(const TripleReader& read, uint64_t first) {
+    return [read, first](uint64_t column, uint64_t start, uint64_t count, uint64_t* out) {
+        read(column, first + start, count, out);
+    };
+}
@@ -0,0 +1,211 @@
+#pragma once
+#include<atomic>
+#include<condition_variable>
+#include<fstream>
+#include<functional>
+#include<mutex>
+#include<sched.h>
+#include<string>
+#include<thread>
+#include<vector>
+
+using namespace std;
+
+// Pins the calling thread to cpu; false where that is not allowed
+bool pin_thread(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+// Fixed-size pool of worker threads. The calling thread also takes part in
+// every run(), so a pool of size n keeps n cores busy with n - 1 workers.
+// Given cpus, the pool is pinned: it has n workers, worker i is pinned to
+// cpus[i % cpus.size()] and always runs tasks t = i mod n, so chunk c of
+// every parallel_for() stays on the same core, and the memory it touches
+// first stays on that core's node. The caller of a pinned pool only waits in
+// run(), so its affinity, and that of the threads it starts, is left alone.
+class ThreadPool {
+public:
+    explicit ThreadPool(uint64_t num_threads, const vector<int>& cpus = vector<int>()) : num_threads(num_threads < 1 ? 1 : num_threads), cpus(cpus) {
+        for(int i = pinned() ? 0 : 1; i < this->num_threads; i++) {
+            workers.push_back(thread([this, i] { worker_loop(i); }));
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            unique_lock<mutex> lock(mtx);
+            stopping = true;
+        }
+        wake.notify_all();
+        for(int i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+    }
+
+    uint64_t size() const {
+        return num_threads;
+    }
+
+    bool pinned() const {
+        return !cpus.empty();
+    }
+
+    // Runs task(t) for every t in [0, num_tasks) and returns when all are done
+    void run(uint64_t num_tasks, const function<void(uint64_t)>& task) {
+        if (!pinned() && (num_threads == 1 || num_tasks <= 1)) {
+            for(uint64_t t = 0; t < num_tasks; t++) {
+                task(t);
+            }
+            return;
+        }
+        {
+            unique_lock<mutex> lock(mtx);
+            current_task = &task;
+            total_tasks = num_tasks;
+            next_task = 0;
+            finished = 0;
+            generation++;
+        }
+        wake.notify_all();
+        uint64_t count = pinned() ? 0 : drain(task, num_tasks, 0);
+        // Workers that never picked this generation up see a null task later;
+        // a pinned pool waits for every worker's own tasks instead
+        unique_lock<mutex> lock(mtx);
+        finished += count;
+        done.wait(lock, [&] { return busy == 0 && (!pinned() || finished == num_tasks); });
+        current_task = nullptr;
+    }
+
+private:
+    // Runs thread index's share of the tasks and returns how many it ran
+    uint64_t drain(const function<void(uint64_t)>& task, uint64_t num_tasks, uint64_t index) {
+        uint64_t count = 0;
+        if (pinned()) {
+            for(uint64_t t = index; t < num_tasks; t += num_threads, count++) {
+                task(t);
+            }
+            return count;
+        }
+        while(true) {
+            uint64_t t = next_task.fetch_add(1);
+            if (t >= num_tasks) break;
+            task(t);
+            count++;
+        }
+        return count;
+    }
+
+    void worker_loop(uint64_t index) {
+        if (pinned()) {
+            pin_thread(cpus[index % cpus.size()]);
+        }
+        uint64_t seen = 0;
+        while(true) {
+            const function<void(uint64_t)>* task;
+            uint64_t num_tasks;
+            {
+                unique_lock<mutex> lock(mtx);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+                task = current_task;
+                num_tasks = total_tasks;
+                if (task == nullptr) continue;
+                busy++;
+            }
+            uint64_t count = drain(*task, num_tasks, index);
+            {
+                unique_lock<mutex> lock(mtx);
+                finished += count;
+                busy--;
+            }
+            done.notify_all();
+        }
+    }
+
+    uint64_t num_threads;
+    vector<int> cpus;
+    vector<thread> workers;
+    mutex mtx;
+    condition_variable wake, done;
+    const function<void(uint64_t)>* current_task = nullptr;
+    uint64_t total_tasks = 0;
+    uint64_t generation = 0;
+    uint64_t busy = 0;
+    uint64_t finished = 0;
+    atomic<uint64_t> next_task{0};
+    bool stopping = false;
+};
+
+// Splits [0, size) into one contiguous chunk per thread and calls
+// body(chunk_id, start, end) for each. Chunk starts are multiples of 8 so
+// vector kernels see aligned ranges. A null pool runs a single chunk inline.
+void parallel_for(ThreadPool* pool, uint64_t size, uint64_t num_chunks, const function<void(uint64_t, uint64_t, uint64_t)>& body) {
+    if (pool == nullptr || num_chunks <= 1 || size == 0) {
+        body(0, 0, size);
+        return;
+    }
+    uint64_t step = ((size - 1) / num_chunks / 8 + 1) * 8;
+    pool->run(num_chunks, [&](uint64_t c) {
+        uint64_t start = c * step < size ? c * step : size;
+        uint64_t end = start + step < size ? start + step : size;
+        body(c, start, end);
+    });
+}
+
+uint64_t num_chunks_of(ThreadPool* pool) {
+    return pool == nullptr ? 1 : pool->size();
+}
+
+// CPUs of every NUMA node from sysfs, e.g. "0-3,8-11" in node0/cpulist. A
+// machine without node directories is one node with every CPU.
+vector< vector<int> > numa_nodes() {
+    vector< vector<int> > nodes;
+    for(int node = 0; ; node++) {
+        ifstream file("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+        string list;
+        if (!file || !getline(file, list)) break;
+        vector<int> cpus;
+        size_t pos = 0;
+        while(pos < list.size()) {
+            size_t comma = list.find(',', pos);
+            string range = list.substr(pos, comma == string::npos ? string::npos : comma - pos);
+            size_t dash = range.find('-');
+            if (!range.empty()) {
+                int first = stoi(range.substr(0, dash));
+                int last = dash == string::npos ? first : stoi(range.substr(dash + 1));
+                for(int cpu = first; cpu <= last; cpu++) {
+                    cpus.push_back(cpu);
+                }
+            }
+            pos = comma == string::npos ? list.size() : comma + 1;
+        }
+        if (!cpus.empty()) {
+            nodes.push_back(cpus);
+        }
+    }
+    if (nodes.empty()) {
+        nodes.push_back(vector<int>());
+        for(int cpu = 0; cpu < thread::hardware_concurrency(); cpu++) {
+            nodes[0].push_back(cpu);
+        }
+    }
+    return nodes;
+}
+
+// CPUs for a pinned pool of n threads: threads [i * n / nodes, (i + 1) * n /
+// nodes) go to node i. parallel_for() hands out contiguous ranges in thread
+// order, so every row's positions are split between the nodes in order.
+vector<int> numa_cpus(uint64_t num_threads) {
+    vector< vector<int> > nodes = numa_nodes();
+    vector<int> cpus;
+    for(uint64_t i = 0; i < num_threads; i++) {
+        uint64_t node = i * nodes.size() / num_threads;
+        uint64_t first = (node * num_threads + nodes.size() - 1) / nodes.size();
+        cpus.push_back(nodes[node][(i - first) % nodes[node].size()]);
+    }
+    return cpus;
+}
@@ -0,0 +1,151 @@
+#pragma once
+#include "arithmetic.h"
+#include "stream.h"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+// On-disk layout of a batch of triples. A 64-byte header is followed by the L
+// columns, one after another. Column c starts column_words * 8 * c bytes after
+// the header and packs its T entries at TRACE_BITS bits each, entry i at bit
+// i * TRACE_BITS, least significant bit first. Every column ends with one spare
+// word so that any entry can be read with two aligned 64-bit loads. All
+// integers are little endian.
+const char TRACE_MAGIC[8] = {'D', 'Z', 'K', 'P', 'T', 'R', 'C', 0};
+const uint32_t TRACE_VERSION = 1;
+const uint32_t TRACE_BITS = 61;
+
+struct TraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t bits;
+    uint64_t columns;
+    uint64_t size;
+    uint64_t column_words;
+    uint64_t reserved[3];
+};
+static_assert(sizeof(TraceHeader) == 64, "the trace header is 64 bytes");
+
+uint64_t trace_column_words(uint64_t T) {
+    return (T * TRACE_BITS + 63) / 64 + 1;
+}
+
+// Writes L columns of T field elements as a trace file
+bool write_trace(const char* path, uint64_t** input, uint64_t L, uint64_t T) {
+    TraceHeader header = {};
+    memcpy(header.magic, TRACE_MAGIC, 8);
+    header.version = TRACE_VERSION;
+    header.bits = TRACE_BITS;
+    header.columns = L;
+    header.size = T;
+    header.column_words = trace_column_words(T);
+    FILE* file = fopen(path, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    vector<uint64_t> words(header.column_words);
+    for(int c = 0; c < L && ok; c++) {
+        fill(words.begin(), words.end(), 0);
+        for(uint64_t i = 0; i < T; i++) {
+            uint64_t value = modp(input[c][i]);
+            uint64_t bit = i * TRACE_BITS;
+            uint64_t offset = bit % 64;
+            words[bit / 64] |= value << offset;
+            if (offset > 64 - TRACE_BITS) {
+                words[bit / 64 + 1] |= value >> (64 - offset);
+            }
+        }
+        ok = fwrite(words.data(), sizeof(uint64_t), words.size(), file) == words.size();
+    }
+    return fclose(file) == 0 && ok;
+}
+
+// Read-only mapping of a trace file. Pages come straight from the page cache,
+// so any number of prover and verifier processes can share one trace without
+// copying it; entries are unpacked only when they are read.
+class TraceFile {
+public:
+    TraceFile() = default;
+    TraceFile(const TraceFile&) = delete;
+    TraceFile& operator=(const TraceFile&) = delete;
+
+    ~TraceFile() {
+        if (data != nullptr) {
+            munmap((void*)data, mapped_size);
+        }
+    }
+
+    // Maps path and checks its header; prints the reason and returns false if
+    // the file is not a trace this code can read
+    bool open(const char* path) {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            cout << "Could not open " << path << endl;
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size < sizeof(TraceHeader)) {
+            cout << path << " is too short for a trace" << endl;
+            ::close(fd);
+            return false;
+        }
+        void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            cout << "Could not map " << path << endl;
+            return false;
+        }
+        data = (const char*)mapping;
+        mapped_size = info.st_size;
+        memcpy(&header, data, sizeof(header));
+        // Sizes are checked against the words in the file by dividing, so a
+        // crafted header cannot overflow them
+        uint64_t words = (mapped_size - sizeof(TraceHeader)) / sizeof(uint64_t);
+        if (memcmp(header.magic, TRACE_MAGIC, 8) != 0 || header.version != TRACE_VERSION || header.bits != TRACE_BITS
+            || header.size == 0 || header.size > words * 64 / TRACE_BITS
+            || header.column_words != trace_column_words(header.size)
+            || header.columns > words / header.column_words) {
+            cout << path << " is not a valid trace" << endl;
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t columns() const {
+        return header.columns;
+    }
+
+    uint64_t size() const {
+        return header.size;
+    }
+
+    // Unpacks entries [start, start + count) of column into out
+    void read(uint64_t column, uint64_t start, uint64_t count, uint64_t* out) const {
+        const uint64_t* words = (const uint64_t*)(data + sizeof(TraceHeader)) + column * header.column_words;
+        uint64_t bit = start * TRACE_BITS;
+        for(uint64_t i = 0; i < count; i++, bit += TRACE_BITS) {
+            uint64_t offset = bit % 64;
+            uint64_t low = words[bit / 64] >> offset;
+            uint64_t high = (words[bit / 64 + 1] << 1) << (63 - offset);
+            out[i] = (low | high) & PR;
+        }
+    }
+
+    // Reader over the mapping; valid while this TraceFile is alive
+    TripleReader reader() const {
+        return [this](uint64_t column, uint64_t start, uint64_t count, uint64_t* out) {
+            read(column, start, count, out);
+        };
+    }
+
+private:
+    const char* data = nullptr;
+    uint64_t mapped_size = 0;
+    TraceHeader header = {};
+};
@@ -0,0 +1,167 @@
+#pragma once
+#include "arithmetic.h"
+#include <cstring>
+
+using namespace std;
+
+const uint64_t KECCAK_ROUND_CONSTANTS[24] = {
+    0x0000000000000001ULL, 0x0000000000008082ULL, 0x800000000000808aULL, 0x8000000080008000ULL,
+    0x000000000000808bULL, 0x0000000080000001ULL, 0x8000000080008081ULL, 0x8000000000008009ULL,
+    0x000000000000008aULL, 0x0000000000000088ULL, 0x0000000080008009ULL, 0x000000008000000aULL,
+    0x000000008000808bULL, 0x800000000000008bULL, 0x8000000000008089ULL, 0x8000000000008003ULL,
+    0x8000000000008002ULL, 0x8000000000000080ULL, 0x000000000000800aULL, 0x800000008000000aULL,
+    0x8000000080008081ULL, 0x8000000000008080ULL, 0x0000000080000001ULL, 0x8000000080008008ULL
+};
+const int KECCAK_ROTATIONS[24] = {1, 3, 6, 10, 15, 21, 28, 36, 45, 55, 2, 14, 27, 41, 56, 8, 25, 43, 62, 18, 39, 61, 20, 44};
+const int KECCAK_PI_LANES[24] = {10, 7, 11, 17, 18, 3, 5, 16, 8, 21, 24, 4, 15, 23, 19, 13, 12, 2, 20, 14, 22, 9, 6, 1};
+
+inline uint64_t rotl64(uint64_t x, int n) {
+    return (x << n) | (x >> (64 - n));
+}
+
+void keccak_f1600(uint64_t* state) {
+    uint64_t bc[5];
+    for(int round = 0; round < 24; round++) {
+        for(int i = 0; i < 5; i++) {
+            bc[i] = state[i] ^ state[i + 5] ^ state[i + 10] ^ state[i + 15] ^ state[i + 20];
+        }
+        for(int i = 0; i < 5; i++) {
+            uint64_t t = bc[(i + 4) % 5] ^ rotl64(bc[(i + 1) % 5], 1);
+            for(int j = 0; j < 25; j += 5) {
+                state[j + i] ^= t;
+            }
+        }
+        uint64_t t = state[1];
+        for(int i = 0; i < 24; i++) {
+            int j = KECCAK_PI_LANES[i];
+            uint64_t next = state[j];
+            state[j] = rotl64(t, KECCAK_ROTATIONS[i]);
+            t = next;
+        }
+        for(int j = 0; j < 25; j += 5) {
+            for(int i = 0; i < 5; i++) {
+                bc[i] = state[j + i];
+            }
+            for(int i = 0; i < 5; i++) {
+                state[j + i] ^= (~bc[(i + 1) % 5]) & bc[(i + 2) % 5];
+            }
+        }
+        state[0] ^= KECCAK_ROUND_CONSTANTS[round];
+    }
+}
+
+// SHAKE128 sponge: absorb() any number of times, then squeeze() any number
+// of bytes. Bytes map to lanes little endian, as in FIPS 202.
+class Shake128 {
+public:
+    static const uint64_t RATE = 168;
+
+    void absorb(const uint8_t* data, uint64_t size) {
+        for(uint64_t i = 0; i < size; i++) {
+            state[position / 8] ^= (uint64_t)data[i] << (8 * (position % 8));
+            if (++position == RATE) {
+                keccak_f1600(state);
+                position = 0;
+            }
+        }
+    }
+
+    void squeeze(uint8_t* out, uint64_t size) {
+        if (!squeezing) {
+            state[position / 8] ^= (uint64_t)0x1f << (8 * (position % 8));
+            state[(RATE - 1) / 8] ^= (uint64_t)0x80 << (8 * ((RATE - 1) % 8));
+            keccak_f1600(state);
+            position = 0;
+            squeezing = true;
+        }
+        for(uint64_t i = 0; i < size; i++) {
+            if (position == RATE) {
+                keccak_f1600(state);
+                position = 0;
+            }
+            out[i] = state[position / 8] >> (8 * (position % 8));
+            position++;
+        }
+    }
+
+private:
+    uint64_t state[25] = {};
+    uint64_t position = 0;
+    bool squeezing = false;
+};
+
+void shake128(const uint8_t* data, uint64_t size, uint8_t* out, uint64_t out_size) {
+    Shake128 sponge;
+    sponge.absorb(data, size);
+    sponge.squeeze(out, out_size);
+}
+
+// Fiat-Shamir transcript in the style of merlin: every message is absorbed
+// into one SHAKE128 sponge framed by its label and length, and a challenge is
+// squeezed from a copy of the sponge, then absorbed back so that later
+// challenges depend on it. The prover and the verifier must append the same
+// messages in the same order to draw the same challenges.
+class Transcript {
+public:
+    explicit Transcript(const char* label) {
+        append_message("dom-sep", (const uint8_t*)label, strlen(label));
+    }
+
+    void append_message(const char* label, const uint8_t* data, uint64_t size) {
+        absorb_framed(label, size);
+        sponge.absorb(data, size);
+    }
+
+    void append_u64(const char* label, uint64_t value) {
+        uint8_t bytes[8];
+        store_le(value, bytes);
+        append_message(label, bytes, 8);
+    }
+
+    // count field elements, 8 little-endian bytes each
+    void append_field(const char* label, const uint64_t* values, uint64_t count) {
+        absorb_framed(label, 8 * count);
+        uint8_t bytes[8];
+        for(uint64_t i = 0; i < count; i++) {
+            store_le(values[i], bytes);
+            sponge.absorb(bytes, 8);
+        }
+    }
+
+    // Uniform element of [0, PR): 61-bit samples are drawn until one is below PR
+    uint64_t challenge_field(const char* label) {
+        absorb_framed(label, 8);
+        Shake128 output = sponge;
+        uint64_t value;
+        do {
+            uint8_t bytes[8];
+            output.squeeze(bytes, 8);
+            value = 0;
+            for(int i = 7; i >= 0; i--) {
+                value = (value << 8) | bytes[i];
+            }
+            value &= PR;
+        } while(value == PR);
+        append_u64(label, value);
+        return value;
+    }
+
+private:
+    static void store_le(uint64_t value, uint8_t* bytes) {
+        for(int i = 0; i < 8; i++) {
+            bytes[i] = value >> (8 * i);
+        }
+    }
+
+    void absorb_framed(const char* label, uint64_t size) {
+        uint8_t bytes[8];
+        uint64_t label_size = strlen(label);
+        store_le(label_size, bytes);
+        sponge.absorb(bytes, 8);
+        sponge.absorb((const uint8_t*)label, label_size);
+        store_le(size, bytes);
+        sponge.absorb(bytes, 8);
+    }
+
+    Shake128 sponge;
+};
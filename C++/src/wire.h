@@ -0,0 +1,425 @@
+#pragma once
+#include "arithmetic.h"
+#include "proof.h"
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+// Messages between parties. Each starts with a 32-byte header naming its
+// kind, the number of rounds and the number of field elements it carries.
+// Field elements are packed at 61 bits each, element i at bit 61 * i, least
+// significant bit first, so 8 elements take 61 bytes; the packed block ends
+// with 8 spare bytes so any element can be read with one unaligned load and
+// one extra byte. All integers are little endian.
+//
+// A proof is the header, the 16-byte mask seed, one 64-bit coefficient
+// count per round, and the second shares of all rounds packed back to back.
+// A VerMsg is the header (rounds = number of sum checks) and the packed
+// p_eval_ksum_ss, p_eval_r_ss, final_input and final_result_ss. A list of
+// elements, such as the share of one round sent on its own, is the header
+// (rounds = 1) and the packed elements.
+const char WIRE_MAGIC[8] = {'D', 'Z', 'K', 'P', 'W', 'I', 'R', 'E'};
+const uint32_t WIRE_VERSION = 1;
+const uint32_t WIRE_PROOF = 1;
+const uint32_t WIRE_VERMSG = 2;
+const uint32_t WIRE_ELEMENTS = 3;
+
+struct WireHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t kind;
+    uint64_t rounds;
+    uint64_t elements;
+};
+static_assert(sizeof(WireHeader) == 32, "the wire header is 32 bytes");
+
+uint64_t get_u64(const uint8_t* data) {
+    uint64_t value = 0;
+    for(int i = 7; i >= 0; i--) {
+        value = (value << 8) | data[i];
+    }
+    return value;
+}
+
+uint64_t packed_bytes(uint64_t count) {
+    return (count * 61 + 7) / 8 + 8;
+}
+
+// Writes field elements at 61 bits each; finish() flushes the last bits and
+// the spare bytes, packed_bytes(count) bytes in all
+class BitPacker {
+public:
+    explicit BitPacker(uint8_t* out) : out(out) {}
+
+    void push(uint64_t value) {
+        acc |= (uint128_t)value << bits;
+        bits += 61;
+        if (bits >= 64) {
+            uint64_t word = (uint64_t)acc;
+            memcpy(out, &word, 8);
+            out += 8;
+            acc >>= 64;
+            bits -= 64;
+        }
+    }
+
+    void finish() {
+        uint64_t word = (uint64_t)acc;
+        memcpy(out, &word, 8);
+        out += (bits + 7) / 8;
+        memset(out, 0, 8);
+    }
+
+private:
+    uint8_t* out;
+    uint128_t acc = 0;
+    uint64_t bits = 0;
+};
+
+inline uint64_t unpack_element(const uint8_t* packed, uint64_t i) {
+    uint64_t bit = i * 61;
+    const uint8_t* p = packed + bit / 8;
+    uint64_t shift = bit % 8;
+    uint64_t word;
+    memcpy(&word, p, 8);
+    uint64_t value = word >> shift;
+    if (shift > 3) {
+        value |= (uint64_t)p[8] << (64 - shift);
+    }
+    return value & PR;
+}
+
+// Checks the header of a message of the given kind, that its size is the
+// header, fixed_bytes, round_bytes per round and the packed elements, and
+// that every packed element is below PR; prints the reason if not
+bool check_wire(const uint8_t* data, uint64_t size, uint32_t kind, uint64_t fixed_bytes, uint64_t round_bytes, WireHeader& header) {
+    if (size < sizeof(WireHeader)) {
+        cout << "Message is too short" << endl;
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, WIRE_MAGIC, 8) != 0 || header.version != WIRE_VERSION || header.kind != kind) {
+        cout << "Not a message of kind " << kind << " and version " << WIRE_VERSION << endl;
+        return false;
+    }
+    if (header.elements > size || header.rounds > size
+        || sizeof(WireHeader) + fixed_bytes + round_bytes * header.rounds + packed_bytes(header.elements) != size) {
+        cout << "Message size does not match its header" << endl;
+        return false;
+    }
+    const uint8_t* packed = data + size - packed_bytes(header.elements);
+    for(uint64_t i = 0; i < header.elements; i++) {
+        if (unpack_element(packed, i) == PR) {
+            cout << "Element " << i << " is not a field element" << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+void serialize_proof(const Proof& proof, vector<uint8_t>& out) {
+    uint64_t rounds = proof.p_coeffs_ss2.size(), elements = 0;
+    for(int r = 0; r < rounds; r++) {
+        elements += proof.p_coeffs_ss2[r].size();
+    }
+    WireHeader header = {};
+    memcpy(header.magic, WIRE_MAGIC, 8);
+    header.version = WIRE_VERSION;
+    header.kind = WIRE_PROOF;
+    header.rounds = rounds;
+    header.elements = elements;
+    out.resize(sizeof(header) + MASK_SEED_BYTES + 8 * rounds + packed_bytes(elements));
+    uint8_t* p = out.data();
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+    memcpy(p, proof.mask_seed, MASK_SEED_BYTES);
+    p += MASK_SEED_BYTES;
+    for(int r = 0; r < rounds; r++, p += 8) {
+        uint64_t count = proof.p_coeffs_ss2[r].size();
+        memcpy(p, &count, 8);
+    }
+    BitPacker packer(p);
+    for(int r = 0; r < rounds; r++) {
+        const vector<uint64_t>& share = proof.p_coeffs_ss2[r];
+        for(int i = 0; i < share.size(); i++) {
+            packer.push(share[i]);
+        }
+    }
+    packer.finish();
+}
+
+vector<uint8_t> serialize_proof(const Proof& proof) {
+    vector<uint8_t> out;
+    serialize_proof(proof, out);
+    return out;
+}
+
+// Reads a serialized proof in place: parse() checks it once, after which
+// the accessors unpack straight from the buffer, which must outlive the view
+class ProofView {
+public:
+    // Prints the reason and returns false if data is not a valid proof
+    bool parse(const uint8_t* data, uint64_t size) {
+        if (!check_wire(data, size, WIRE_PROOF, MASK_SEED_BYTES, 8, header)) {
+            return false;
+        }
+        seed_bytes = data + sizeof(WireHeader);
+        counts = seed_bytes + MASK_SEED_BYTES;
+        packed = counts + 8 * header.rounds;
+        uint64_t total = 0;
+        for(uint64_t r = 0; r < header.rounds; r++) {
+            uint64_t count = round_size(r);
+            if (count > header.elements - total) {
+                cout << "Round sizes do not add up to the header" << endl;
+                return false;
+            }
+            total += count;
+        }
+        if (total != header.elements) {
+            cout << "Round sizes do not add up to the header" << endl;
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t rounds() const {
+        return header.rounds;
+    }
+
+    const uint8_t* seed() const {
+        return seed_bytes;
+    }
+
+    uint64_t round_size(uint64_t r) const {
+        uint64_t count;
+        memcpy(&count, counts + 8 * r, 8);
+        return count;
+    }
+
+    // Second share of round r into out
+    void round(uint64_t r, uint64_t* out) const {
+        uint64_t start = 0;
+        for(uint64_t i = 0; i < r; i++) {
+            start += round_size(i);
+        }
+        uint64_t count = round_size(r);
+        for(uint64_t i = 0; i < count; i++) {
+            out[i] = unpack_element(packed, start + i);
+        }
+    }
+
+private:
+    WireHeader header = {};
+    const uint8_t* seed_bytes = nullptr;
+    const uint8_t* counts = nullptr;
+    const uint8_t* packed = nullptr;
+};
+
+// Decodes a proof and expands its first shares from the seed; prints the
+// reason and returns false if the bytes are not a valid proof
+bool deserialize_proof(const uint8_t* data, uint64_t size, Proof& proof) {
+    ProofView view;
+    if (!view.parse(data, size)) {
+        return false;
+    }
+    memcpy(proof.mask_seed, view.seed(), MASK_SEED_BYTES);
+    vector<uint64_t> sizes(view.rounds());
+    proof.p_coeffs_ss2.resize(view.rounds());
+    for(uint64_t r = 0; r < view.rounds(); r++) {
+        sizes[r] = view.round_size(r);
+        proof.p_coeffs_ss2[r].resize(sizes[r]);
+        view.round(r, proof.p_coeffs_ss2[r].data());
+    }
+    proof.p_coeffs_ss1 = expand_mask_shares(proof.mask_seed, sizes);
+    return true;
+}
+
+void serialize_vermsg(const VerMsg& vermsg, vector<uint8_t>& out) {
+    uint64_t len = vermsg.p_eval_ksum_ss.size();
+    WireHeader header = {};
+    memcpy(header.magic, WIRE_MAGIC, 8);
+    header.version = WIRE_VERSION;
+    header.kind = WIRE_VERMSG;
+    header.rounds = len;
+    header.elements = 2 * len + 2;
+    out.resize(sizeof(header) + packed_bytes(header.elements));
+    memcpy(out.data(), &header, sizeof(header));
+    BitPacker packer(out.data() + sizeof(header));
+    for(int i = 0; i < len; i++) {
+        packer.push(vermsg.p_eval_ksum_ss[i]);
+    }
+    for(int i = 0; i < len; i++) {
+        packer.push(vermsg.p_eval_r_ss[i]);
+    }
+    packer.push(vermsg.final_input);
+    packer.push(vermsg.final_result_ss);
+    packer.finish();
+}
+
+// VerMsg counterpart of ProofView
+class VerMsgView {
+public:
+    bool parse(const uint8_t* data, uint64_t size) {
+        if (!check_wire(data, size, WIRE_VERMSG, 0, 0, header)) {
+            return false;
+        }
+        if (header.elements != 2 * header.rounds + 2) {
+            cout << "Message size does not match its header" << endl;
+            return false;
+        }
+        packed = data + sizeof(WireHeader);
+        return true;
+    }
+
+    uint64_t rounds() const {
+        return header.rounds;
+    }
+
+    uint64_t p_eval_ksum_ss(uint64_t i) const {
+        return unpack_element(packed, i);
+    }
+
+    uint64_t p_eval_r_ss(uint64_t i) const {
+        return unpack_element(packed, header.rounds + i);
+    }
+
+    uint64_t final_input() const {
+        return unpack_element(packed, 2 * header.rounds);
+    }
+
+    uint64_t final_result_ss() const {
+        return unpack_element(packed, 2 * header.rounds + 1);
+    }
+
+private:
+    WireHeader header = {};
+    const uint8_t* packed = nullptr;
+};
+
+bool deserialize_vermsg(const uint8_t* data, uint64_t size, VerMsg& vermsg) {
+    VerMsgView view;
+    if (!view.parse(data, size)) {
+        return false;
+    }
+    vermsg.p_eval_ksum_ss.resize(view.rounds());
+    vermsg.p_eval_r_ss.resize(view.rounds());
+    for(uint64_t i = 0; i < view.rounds(); i++) {
+        vermsg.p_eval_ksum_ss[i] = view.p_eval_ksum_ss(i);
+        vermsg.p_eval_r_ss[i] = view.p_eval_r_ss(i);
+    }
+    vermsg.final_input = view.final_input();
+    vermsg.final_result_ss = view.final_result_ss();
+    return true;
+}
+
+void serialize_elements(const uint64_t* values, uint64_t count, vector<uint8_t>& out) {
+    WireHeader header = {};
+    memcpy(header.magic, WIRE_MAGIC, 8);
+    header.version = WIRE_VERSION;
+    header.kind = WIRE_ELEMENTS;
+    header.rounds = 1;
+    header.elements = count;
+    out.resize(sizeof(header) + packed_bytes(count));
+    memcpy(out.data(), &header, sizeof(header));
+    BitPacker packer(out.data() + sizeof(header));
+    for(uint64_t i = 0; i < count; i++) {
+        packer.push(values[i]);
+    }
+    packer.finish();
+}
+
+bool deserialize_elements(const uint8_t* data, uint64_t size, vector<uint64_t>& values) {
+    WireHeader header;
+    if (!check_wire(data, size, WIRE_ELEMENTS, 0, 0, header)) {
+        return false;
+    }
+    if (header.rounds != 1) {
+        cout << "Message size does not match its header" << endl;
+        return false;
+    }
+    const uint8_t* packed = data + sizeof(WireHeader);
+    values.resize(header.elements);
+    for(uint64_t i = 0; i < header.elements; i++) {
+        values[i] = unpack_element(packed, i);
+    }
+    return true;
+}
+
+// The proof as ark_serialize 0.3 writes the Rust Proof in dzkp/ with
+// CanonicalSerialize: fields in order, every Vec as a u64 length followed by
+// its items, every u64 as 8 bytes little endian. Both shares are written,
+// since the Rust verifier does not know the mask seed.
+void serialize_proof_ark(const Proof& proof, vector<uint8_t>& out) {
+    const vector< vector<uint64_t> >* shares[2] = {&proof.p_coeffs_ss1, &proof.p_coeffs_ss2};
+    uint64_t words = 0;
+    for(int s = 0; s < 2; s++) {
+        words += 1 + shares[s]->size();
+        for(int r = 0; r < shares[s]->size(); r++) {
+            words += (*shares[s])[r].size();
+        }
+    }
+    out.resize(8 * words);
+    uint8_t* p = out.data();
+    for(int s = 0; s < 2; s++) {
+        uint64_t rounds = shares[s]->size();
+        memcpy(p, &rounds, 8);
+        p += 8;
+        for(int r = 0; r < rounds; r++) {
+            const vector<uint64_t>& share = (*shares[s])[r];
+            uint64_t count = share.size();
+            memcpy(p, &count, 8);
+            memcpy(p + 8, share.data(), 8 * count);
+            p += 8 * (count + 1);
+        }
+    }
+}
+
+// Reads what serialize_proof_ark() or the Rust prover's proof.serialize()
+// writes; the mask seed is left zero. Prints the reason and returns false if
+// the bytes are not a proof or a word is not a field element.
+bool deserialize_proof_ark(const uint8_t* data, uint64_t size, Proof& proof) {
+    vector< vector<uint64_t> >* shares[2] = {&proof.p_coeffs_ss1, &proof.p_coeffs_ss2};
+    uint64_t offset = 0;
+    for(int s = 0; s < 2; s++) {
+        if (size - offset < 8) {
+            cout << "ark proof is truncated" << endl;
+            return false;
+        }
+        uint64_t rounds = get_u64(data + offset);
+        offset += 8;
+        if (rounds > (size - offset) / 8) {
+            cout << "ark proof is truncated" << endl;
+            return false;
+        }
+        shares[s]->resize(rounds);
+        for(uint64_t r = 0; r < rounds; r++) {
+            if (size - offset < 8) {
+                cout << "ark proof is truncated" << endl;
+                return false;
+            }
+            uint64_t count = get_u64(data + offset);
+            offset += 8;
+            if (count > (size - offset) / 8) {
+                cout << "ark proof is truncated" << endl;
+                return false;
+            }
+            vector<uint64_t>& share = (*shares[s])[r];
+            share.resize(count);
+            memcpy(share.data(), data + offset, 8 * count);
+            offset += 8 * count;
+            for(uint64_t i = 0; i < count; i++) {
+                if (share[i] >= PR) {
+                    cout << "ark proof element " << i << " of round " << r << " is not a field element" << endl;
+                    return false;
+                }
+            }
+        }
+    }
+    if (offset != size) {
+        cout << "ark proof has " << size - offset << " trailing bytes" << endl;
+        return false;
+    }
+    memset(proof.mask_seed, 0, MASK_SEED_BYTES);
+    return true;
+}